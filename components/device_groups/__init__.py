@@ -4,7 +4,7 @@ from esphome.const import (
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import switch, light
-from esphome.core import CORE
+from esphome.core import CORE, TimePeriod
 
 CODEOWNERS = ["@Cossid"]
 DEPENDENCIES = ["network"]
@@ -14,29 +14,87 @@ device_groups = device_groups_ns.class_("device_groups", cg.Component)
 
 MULTI_CONF = True
 CONF_GROUP_NAME = "group_name"
+CONF_GROUP_NAMES = "group_names"
 CONF_SWITCHES = "switches"
 CONF_LIGHTS = "lights"
 CONF_SEND_MASK = "send_mask"
 CONF_RECEIVE_MASK = "receive_mask"
+CONF_SCHEMES = "schemes"
+CONF_SCHEME = "scheme"
+CONF_EFFECT = "effect"
+CONF_MAX_ACK_DELAY = "max_ack_delay"
+CONF_MAX_PACKETS_PER_LOOP = "max_packets_per_loop"
+CONF_MAX_LOOP_TIME = "max_loop_time"
 
-CONFIG_SCHEMA = cv.Schema(
+GROUP_NAME_SCHEMA = cv.All(cv.string, cv.Length(min=1, max=150))
+
+SCHEME_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_SCHEME): cv.int_range(min=1, max=255),
+        cv.Required(CONF_EFFECT): cv.string,
+    }
+)
+
+
+def validate_group_names(config):
+    # Group N follows relay N, and each switch is a relay.
+    if CONF_GROUP_NAMES in config:
+        relays = max(len(config.get(CONF_SWITCHES, [])), 1)
+        if len(config[CONF_GROUP_NAMES]) > relays:
+            raise cv.Invalid(
+                f"{CONF_GROUP_NAMES} has {len(config[CONF_GROUP_NAMES])} groups but there are only {relays} relays"
+            )
+    return config
+
+
+def validate_lights(config):
+    # A group message holds one value per item, so it can only describe one light.
+    if len(config.get(CONF_LIGHTS, [])) > 1:
+        raise cv.Invalid(
+            f"{CONF_LIGHTS} has {len(config[CONF_LIGHTS])} lights but a group can only share one, put each in its own group"
+        )
+    return config
+
+
+def validate_schemes(config):
+    if CONF_SCHEMES in config and CONF_LIGHTS not in config:
+        raise cv.Invalid(f"{CONF_SCHEMES} need {CONF_LIGHTS} to run the effects on")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(cv.Schema(
     {
         cv.GenerateID(CONF_ID): cv.declare_id(device_groups),
-        cv.Required(CONF_GROUP_NAME): cv.string,
-        cv.Optional(CONF_SWITCHES): cv.All(cv.ensure_list(cv.use_id(switch.Switch)), cv.Length(min=1)),
+        cv.Exclusive(CONF_GROUP_NAME, CONF_GROUP_NAME): GROUP_NAME_SCHEMA,
+        cv.Exclusive(CONF_GROUP_NAMES, CONF_GROUP_NAME): cv.All(cv.ensure_list(GROUP_NAME_SCHEMA), cv.Length(min=1, max=24)),
+        cv.Optional(CONF_SWITCHES): cv.All(cv.ensure_list(cv.use_id(switch.Switch)), cv.Length(min=1, max=24)),
         cv.Optional(CONF_LIGHTS): cv.All(cv.ensure_list(cv.use_id(light.LightState)), cv.Length(min=1)),
+        cv.Optional(CONF_SCHEMES): cv.All(cv.ensure_list(SCHEME_SCHEMA), cv.Length(min=1)),
         cv.Optional(CONF_SEND_MASK, default=0xFFFFFFFF): cv.hex_uint32_t,
         cv.Optional(CONF_RECEIVE_MASK, default=0xFFFFFFFF): cv.hex_uint32_t,
+        cv.Optional(CONF_MAX_ACK_DELAY, default="0ms"): cv.All(
+            cv.positive_time_period_milliseconds, cv.Range(max=TimePeriod(milliseconds=100))
+        ),
+        cv.Optional(CONF_MAX_PACKETS_PER_LOOP, default=8): cv.int_range(min=0, max=255),
+        cv.Optional(CONF_MAX_LOOP_TIME, default="10ms"): cv.positive_time_period_microseconds,
     }, cv.has_at_least_one_key(CONF_SWITCHES, CONF_LIGHTS)
-).extend(cv.COMPONENT_SCHEMA)
+).extend(cv.COMPONENT_SCHEMA), cv.has_exactly_one_key(CONF_GROUP_NAME, CONF_GROUP_NAMES), validate_group_names,
+                       validate_lights, validate_schemes)
 
 
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
-    cg.add(var.register_device_group_name(str(config[CONF_GROUP_NAME])))
+    if CONF_GROUP_NAMES in config:
+        cg.add(var.set_multiple_device_groups(True))
+        for group_name in config[CONF_GROUP_NAMES]:
+            cg.add(var.register_device_group_name(str(group_name)))
+    else:
+        cg.add(var.register_device_group_name(str(config[CONF_GROUP_NAME])))
     cg.add(var.register_send_mask(config[CONF_SEND_MASK]))
     cg.add(var.register_receive_mask(config[CONF_RECEIVE_MASK]))
+    cg.add(var.set_max_ack_delay(config[CONF_MAX_ACK_DELAY].total_milliseconds))
+    cg.add(var.set_loop_budget(config[CONF_MAX_PACKETS_PER_LOOP], config[CONF_MAX_LOOP_TIME].total_microseconds))
 
     if CONF_SWITCHES in config:
         switches = []
@@ -51,3 +109,7 @@ async def to_code(config):
             new_light = await cg.get_variable(light)
             lights.append(new_light)
         cg.add(var.register_lights(lights))
+
+    if CONF_SCHEMES in config:
+        for scheme in config[CONF_SCHEMES]:
+            cg.add(var.register_scheme(scheme[CONF_SCHEME], str(scheme[CONF_EFFECT])))
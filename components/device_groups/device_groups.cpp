@@ -9,12 +9,46 @@ namespace device_groups {
 
 static const char *const TAG = "dgr";
 
+XDRVMAILBOX device_groups::XdrvMailbox;
+
+// All timing and randomness goes through these, so a simulation can run the protocol on a virtual
+// clock with a seeded generator.
+uint32_t DeviceGroupsMillis() {
+#ifdef USE_DEVICE_GROUPS_SIM
+  return device_groups_SimUDP::now();
+#else
+  return millis();
+#endif
+}
+
+uint32_t DeviceGroupsMicros() {
+#ifdef USE_DEVICE_GROUPS_SIM
+  return device_groups_SimUDP::micros();
+#else
+  return micros();
+#endif
+}
+
+uint32_t DeviceGroupsRandom() {
+#ifdef USE_DEVICE_GROUPS_SIM
+  return device_groups_SimUDP::random();
+#else
+  return random_uint32();
+#endif
+}
+
 char *IPAddressToString(const IPAddress &ip_address) {
   static char buffer[16];
   sprintf_P(buffer, PSTR("%u.%u.%u.%u"), ip_address[0], ip_address[1], ip_address[2], ip_address[3]);
   return buffer;
 }
 
+#ifdef USE_DEVICE_GROUPS_TRACE
+uint32_t DeviceGroupTraceAddress(const IPAddress &ip_address) {
+  return ip_address[0] << 24 | ip_address[1] << 16 | ip_address[2] << 8 | ip_address[3];
+}
+#endif  // USE_DEVICE_GROUPS_TRACE
+
 uint8_t *BeginDeviceGroupMessage(struct device_group *device_group, uint16_t flags, bool hold_sequence = false) {
   uint8_t *message_ptr = &device_group->message[device_group->message_header_length];
   if (!hold_sequence && !++device_group->outgoing_sequence)
@@ -45,155 +79,595 @@ uint32_t DeviceGroupSharedMask(uint8_t item) {
   return mask;
 }
 
-void device_groups::setup() {
-  ESP_LOGCONFIG(TAG, "Setting up Device Groups Component for group %s", this->device_group_name_.c_str());
+uint8_t *AppendDeviceGroupItem(uint8_t *message_ptr, uint8_t item, uint32_t value) {
+  *message_ptr++ = item;
+  *message_ptr++ = value & 0xff;
+  if (item > DGR_ITEM_MAX_8BIT) {
+    *message_ptr++ = (value >> 8) & 0xff;
+    if (item > DGR_ITEM_MAX_16BIT) {
+      *message_ptr++ = (value >> 16) & 0xff;
+      *message_ptr++ = value >> 24;
+    }
+  }
+  return message_ptr;
+}
+
+uint8_t *AppendDeviceGroupItem(uint8_t *message_ptr, uint8_t item, const uint8_t *value, uint8_t length) {
+  *message_ptr++ = item;
+  *message_ptr++ = length;
+  memcpy(message_ptr, value, length);
+  return message_ptr + length;
+}
+
+uint8_t DeviceGroupItemSlot(uint8_t item) {
+  if (item < DGR_ITEM_LAST_8BIT)
+    return DGR_SLOT_FIRST_8BIT + item;
+  if (item > DGR_ITEM_MAX_8BIT && item < DGR_ITEM_LAST_16BIT)
+    return DGR_SLOT_FIRST_16BIT + item - DGR_ITEM_MAX_8BIT - 1;
+  if (item > DGR_ITEM_MAX_16BIT && item < DGR_ITEM_LAST_32BIT)
+    return DGR_SLOT_FIRST_32BIT + item - DGR_ITEM_MAX_16BIT - 1;
+  if (item > DGR_ITEM_MAX_32BIT && item < DGR_ITEM_LAST_STRING)
+    return DGR_SLOT_FIRST_STRING + item - DGR_ITEM_MAX_32BIT - 1;
+  if (item == DGR_ITEM_LIGHT_CHANNELS)
+    return DGR_SLOT_LIGHT_CHANNELS;
+  return DGR_SLOT_NONE;
+}
+
+uint8_t DeviceGroupSlotItem(uint8_t slot) {
+  if (slot < DGR_SLOT_LIGHT_CHANNELS)
+    return DGR_ITEM_MAX_16BIT + 1 + slot - DGR_SLOT_FIRST_32BIT;
+  if (slot == DGR_SLOT_LIGHT_CHANNELS)
+    return DGR_ITEM_LIGHT_CHANNELS;
+  if (slot < DGR_SLOT_FIRST_16BIT)
+    return slot - DGR_SLOT_FIRST_8BIT;
+  if (slot < DGR_SLOT_FIRST_STRING)
+    return DGR_ITEM_MAX_8BIT + 1 + slot - DGR_SLOT_FIRST_16BIT;
+  return DGR_ITEM_MAX_32BIT + 1 + slot - DGR_SLOT_FIRST_STRING;
+}
+
+#ifdef USE_LIGHT
+// Light levels are floats in ESPHome and 0-255 on the wire. The ESP8266 has no FPU, so neither
+// direction does float math at run time: a value is scaled from its IEEE 754 bits in integers, and a
+// level is looked up in a table computed at compile time and kept in flash. Rounding to the nearest
+// step lets a level survive a round trip unchanged.
+uint8_t DeviceGroupLightLevel(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  if ((int32_t) bits <= 0)
+    return 0;  // Zero or negative
+  if (bits >= 0x3f800000)
+    return 255;  // 1.0 or more
+  uint32_t shift = 150 - (bits >> 23);  // value is mantissa >> shift, with shift > 23 below 1.0
+  if (shift > 40)
+    return 0;
+  uint64_t scaled = (uint64_t) ((bits & 0x7fffff) | 0x800000) * 255;
+  return (scaled + ((uint64_t) 1 << (shift - 1))) >> shift;
+}
+
+struct DeviceGroupLightValues {
+  float values[256];
+  constexpr DeviceGroupLightValues() : values() {
+    for (uint32_t level = 0; level < 256; level++)
+      values[level] = level * (1.0f / 255.0f);
+  }
+};
+
+#ifdef USE_ESP8266
+static const DeviceGroupLightValues DEVICE_GROUP_LIGHT_VALUES PROGMEM = DeviceGroupLightValues();
+float DeviceGroupLightValue(uint8_t level) { return pgm_read_float(&DEVICE_GROUP_LIGHT_VALUES.values[level]); }
+#else
+static constexpr DeviceGroupLightValues DEVICE_GROUP_LIGHT_VALUES = DeviceGroupLightValues();
+float DeviceGroupLightValue(uint8_t level) { return DEVICE_GROUP_LIGHT_VALUES.values[level]; }
+#endif
+#endif
+
+void SetDeviceGroupUpdateItem(struct device_group_update *update, uint8_t item, uint8_t flags, uint32_t value,
+                              const void *value_ptr) {
+  uint8_t slot = DeviceGroupItemSlot(item);
+  if (slot == DGR_SLOT_NONE)
+    return;
+  uint32_t slot_mask = 1 << slot;
+  update->present |= slot_mask;
+  update->changed |= slot_mask;
+  if (flags & DGR_ITEM_FLAG_NO_SHARE)
+    update->no_share |= slot_mask;
+  else
+    update->no_share &= ~slot_mask;
+
+  if (item <= DGR_ITEM_MAX_8BIT) {
+    update->values_8bit[item] = value;
+  } else if (item <= DGR_ITEM_MAX_16BIT) {
+    update->values_16bit[item - DGR_ITEM_MAX_8BIT - 1] = value;
+  } else if (item <= DGR_ITEM_MAX_32BIT) {
+    update->values_32bit[item - DGR_ITEM_MAX_16BIT - 1] = value;
+  } else if (item <= DGR_ITEM_MAX_STRING) {
+    char **string = &update->strings[item - DGR_ITEM_MAX_32BIT - 1];
+    free(*string);
+    if (!(*string = strdup((const char *) value_ptr)))
+      update->present &= ~slot_mask;
+  } else {
+    memcpy(update->light_channels, value_ptr, sizeof(update->light_channels));
+  }
+}
+
+void ClearDeviceGroupUpdate(struct device_group_update *update) {
+  for (char *&string : update->strings) {
+    free(string);
+    string = nullptr;
+  }
+  update->present = update->no_share = update->changed = 0;
+}
+
+void ClearDeviceGroupUpdateSlot(struct device_group_update *update, uint8_t slot) {
+  uint8_t item = DeviceGroupSlotItem(slot);
+  if (item > DGR_ITEM_MAX_32BIT && item <= DGR_ITEM_MAX_STRING) {
+    char **string = &update->strings[item - DGR_ITEM_MAX_32BIT - 1];
+    free(*string);
+    *string = nullptr;
+  }
+  update->present &= ~(1 << slot);
+  update->no_share &= ~(1 << slot);
+}
+
+void LoadDeviceGroupUpdate(struct device_group_update *update, const uint8_t *item_ptr, const uint8_t *end_ptr) {
+  uint8_t item;
+  uint8_t item_flags = 0;
+  uint32_t value;
+  while (item_ptr < end_ptr && (item = *item_ptr++)) {
+    if (item == DGR_ITEM_FLAGS) {
+      item_flags = *item_ptr++;
+      continue;
+    }
+    if (item <= DGR_ITEM_MAX_32BIT) {
+      value = *item_ptr++;
+      if (item > DGR_ITEM_MAX_8BIT) {
+        value |= *item_ptr++ << 8;
+        if (item > DGR_ITEM_MAX_16BIT) {
+          value |= *item_ptr++ << 16;
+          value |= (uint32_t) *item_ptr++ << 24;
+        }
+      }
+      SetDeviceGroupUpdateItem(update, item, item_flags, value, nullptr);
+    } else {
+      value = *item_ptr++;
+      SetDeviceGroupUpdateItem(update, item, item_flags, 0, item_ptr);
+      item_ptr += value;
+    }
+    item_flags = 0;
+  }
+}
+
+uint32_t DeviceGroupUpdateItemLength(const struct device_group_update *update, uint8_t slot) {
+  uint8_t item = DeviceGroupSlotItem(slot);
+  uint32_t length = (update->no_share & 1 << slot ? 3 : 1);
+  if (item <= DGR_ITEM_MAX_8BIT)
+    length += 1;
+  else if (item <= DGR_ITEM_MAX_16BIT)
+    length += 2;
+  else if (item <= DGR_ITEM_MAX_32BIT)
+    length += 4;
+  else if (item <= DGR_ITEM_MAX_STRING)
+    length += 1 + strlen(update->strings[item - DGR_ITEM_MAX_32BIT - 1]) + 1;
+  else
+    length += 1 + sizeof(update->light_channels);
+  return length;
+}
+
+uint32_t DeviceGroupUpdateLength(const struct device_group_update *update) {
+  uint32_t length = 1;  // EOL
+  for (uint32_t slot = 0; slot < DGR_SLOT_COUNT; slot++) {
+    if (update->present & 1 << slot)
+      length += DeviceGroupUpdateItemLength(update, slot);
+  }
+  return length;
+}
+
+// Serializes the update's items starting at *slot_ptr, stopping at the first item that doesn't fit
+// before end_ptr. On return, *slot_ptr is the slot to continue from or DGR_SLOT_COUNT if all the
+// items were serialized.
+uint8_t *SerializeDeviceGroupUpdate(const struct device_group_update *update, uint8_t *message_ptr,
+                                    const uint8_t *end_ptr, uint8_t *slot_ptr) {
+  uint32_t slot = *slot_ptr;
+  for (; slot < DGR_SLOT_COUNT; slot++) {
+    uint32_t slot_mask = 1 << slot;
+    if (!(update->present & slot_mask))
+      continue;
+    if (message_ptr + DeviceGroupUpdateItemLength(update, slot) + 1 > end_ptr)
+      break;
+    uint8_t item = DeviceGroupSlotItem(slot);
+    if (update->no_share & slot_mask) {
+      *message_ptr++ = DGR_ITEM_FLAGS;
+      *message_ptr++ = DGR_ITEM_FLAG_NO_SHARE;
+    }
+    if (item <= DGR_ITEM_MAX_8BIT) {
+      message_ptr = AppendDeviceGroupItem(message_ptr, item, update->values_8bit[item]);
+    } else if (item <= DGR_ITEM_MAX_16BIT) {
+      message_ptr = AppendDeviceGroupItem(message_ptr, item, update->values_16bit[item - DGR_ITEM_MAX_8BIT - 1]);
+    } else if (item <= DGR_ITEM_MAX_32BIT) {
+      message_ptr = AppendDeviceGroupItem(message_ptr, item, update->values_32bit[item - DGR_ITEM_MAX_16BIT - 1]);
+    } else if (item <= DGR_ITEM_MAX_STRING) {
+      const char *string = update->strings[item - DGR_ITEM_MAX_32BIT - 1];
+      message_ptr = AppendDeviceGroupItem(message_ptr, item, (const uint8_t *) string, strlen(string) + 1);
+    } else {
+      message_ptr =
+          AppendDeviceGroupItem(message_ptr, item, update->light_channels, sizeof(update->light_channels));
+    }
+  }
+  *message_ptr++ = 0;
+  *slot_ptr = slot;
+  return message_ptr;
+}
+
+// Copies the more-to-come message in the message buffer to the chain buffer, for resends.
+void AddDeviceGroupChainMessage(struct device_group *device_group) {
+  uint32_t chain_length = device_group->chain_length + 2 + device_group->message_length;
+  uint8_t *chain = (uint8_t *) realloc(device_group->chain, chain_length);
+  if (!chain) {
+    ESP_LOGE(TAG, "Error allocating %u-byte chain", chain_length);
+    return;
+  }
+  chain[device_group->chain_length] = device_group->message_length & 0xff;
+  chain[device_group->chain_length + 1] = device_group->message_length >> 8;
+  memcpy(chain + device_group->chain_length + 2, device_group->message, device_group->message_length);
+  device_group->chain = chain;
+  device_group->chain_length = chain_length;
+}
+
+// Returns the sequence a split update starts at from the DGR_ITEM_CHAIN item of its last message,
+// or 0 if the message isn't the last of a split update.
+uint16_t DeviceGroupChainStart(const uint8_t *item_ptr, const uint8_t *end_ptr) {
+  while (item_ptr < end_ptr) {
+    uint8_t item = *item_ptr++;
+    if (item == DGR_ITEM_EOL)
+      break;
+    if (item <= DGR_ITEM_MAX_32BIT) {
+      item_ptr += (item <= DGR_ITEM_MAX_8BIT ? 1 : item <= DGR_ITEM_MAX_16BIT ? 2 : 4);
+    } else if (item_ptr < end_ptr) {
+      uint8_t length = *item_ptr++;
+      if (item == DGR_ITEM_CHAIN && length == 2 && item_ptr + 2 <= end_ptr)
+        return item_ptr[0] | item_ptr[1] << 8;
+      item_ptr += length;
+    }
+  }
+  return 0;
+}
 
-  std::string registered_group_name = this->device_group_name_;
+// Returns true if every message of a split update from chain_start up to, but not including,
+// last_sequence has been received from the member. Parts too old for the window are assumed in.
+bool DeviceGroupChainReceived(const struct device_group_member *device_group_member, uint16_t chain_start,
+                              uint16_t last_sequence) {
+  for (uint16_t sequence = chain_start; sequence != last_sequence; sequence++) {
+    if (!sequence)
+      continue;
+    int16_t offset = device_group_member->received_sequence - sequence;
+    if (offset < 0 || !device_group_member->received_window)
+      return false;
+    if (offset < DGR_RECEIVE_WINDOW && !(device_group_member->received_window & 1U << offset))
+      return false;
+  }
+  return true;
+}
+
+void device_groups::setup() {
+  for (const char *group_name : this->device_group_names_) {
+    ESP_LOGCONFIG(TAG, "Setting up Device Groups Component for group %s", group_name);
 #if defined(ESP8266)
-  registered_group_names.push_back(registered_group_name);
+    registered_group_names.push_back(group_name);
 #endif
+  }
 
+  // Each switch is its own relay, so one power item carries all of them: switch 1 is bit 0, switch 2
+  // is bit 1, and so on. Lights follow relay 1.
 #ifdef USE_SWITCH
-  for (switch_::Switch *obj : this->switches_) {
-    obj->add_on_state_callback([this, obj](bool state) {
-      ExecuteCommandPower(1, state, SRC_SWITCH);
+  if (this->switches_.size() > TasmotaGlobal.devices_present)
+    TasmotaGlobal.devices_present = this->switches_.size();
+  for (uint32_t device = 1; device <= this->switches_.size(); device++) {
+    switch_::Switch *obj = this->switches_[device - 1];
+    if (obj->state)
+      TasmotaGlobal.power |= 1 << (device - 1);
+    obj->add_on_state_callback([this, device](bool state) {
+      InvalidateDeviceGroupStatus();
+      ExecuteCommandPower(device, state, SRC_SWITCH);
     });
   }
 #endif
 #ifdef USE_LIGHT
+  // Each light has its own listener, so an update only looks at the light it came from. The
+  // listeners point into light_descriptors_, which is sized once here and never grows after.
+  this->light_descriptors_.reserve(this->lights_.size());
   for (light::LightState *obj : this->lights_) {
-    set_light_intial_values(obj);
-
-    obj->add_remote_values_listener(this);
+    this->light_descriptors_.emplace_back();
+    struct device_group_light &light = this->light_descriptors_.back();
+    init_light_descriptor(obj, &light);
+    set_light_intial_values(light);
+    if (obj->remote_values.is_on())
+      TasmotaGlobal.power |= 1;
+
+    light.listener.parent = this;
+    light.listener.light = &light;
+    obj->add_remote_values_listener(&light.listener);
+    obj->add_target_state_reached_listener(&light.listener);
   }
 #endif
 }
 
 #ifdef USE_LIGHT
-void device_groups::on_light_remote_values_update() {
-  for (light::LightState *obj : this->lights_) {
-    bool power_state;
-    float brightness, color_brightness, red, green, blue, cold_white, warm_white;
-    esphome::light::ColorMode color_mode;
+void device_group_light_listener::on_light_remote_values_update() {
+  this->parent->on_light_remote_values_update(*this->light);
+}
+
+void device_group_light_listener::on_light_target_state_reached() {
+  this->parent->on_light_target_state_reached(*this->light);
+}
 
-    get_light_values(obj, power_state, brightness, color_brightness, red, green, blue, cold_white, warm_white, color_mode);
+void device_groups::on_light_remote_values_update(struct device_group_light &light) {
+  InvalidateDeviceGroupStatus();
 
-    if (power_state != previous_power_state) {
+  light::LightState *obj = light.obj;
+  bool power_state = obj->remote_values.is_on();
+  uint8_t brightness = DeviceGroupLightLevel(obj->remote_values.get_brightness());
+  uint8_t light_channels[6];
+  get_light_channels(light, light_channels);
+
+  // If the light is still in the state a received message put it in, this is an echo of that
+  // message rather than a local change.
+  if (light.remote_origin) {
+    if (power_state == light.remote_power_state && brightness == light.remote_brightness &&
+        !memcmp(light_channels, light.remote_light_channels, sizeof(light_channels))) {
+#ifdef DEVICE_GROUPS_DEBUG
+      ESP_LOGD(TAG, "Not sending %s echo of a received update", obj->get_name().c_str());
+#endif  // DEVICE_GROUPS_DEBUG
+      light.previous_power_state = power_state;
+      light.previous_brightness = brightness;
+      memcpy(light.previous_light_channels, light_channels, sizeof(light_channels));
+      return;
+    }
+    light.remote_origin = false;
+  }
+
+  if (power_state != light.previous_power_state)
     ExecuteCommandPower(1, power_state, SRC_LIGHT);
+
+  // Local changes jump straight to their target in remote_values, so a transition is one update
+  // plus the fade settings that let the other members run the same transition themselves. Whether
+  // it fades is up to the call that made the change: it fades if it started a transition.
+  struct device_group *device_group = LightDeviceGroup();
+  if (power_state != light.previous_power_state || brightness != light.previous_brightness) {
+    light.transition_start_time = (obj->is_transformer_active() ? millis() | 1 : 0);
+    uint8_t fade = (light.transition_start_time != 0);
+    uint8_t speed = get_light_speed(light);
+    if (device_group && (fade != device_group->light_fade || speed != device_group->light_speed)) {
+      device_group->light_fade = fade;
+      device_group->light_speed = speed;
+      SendDeviceGroupMessage(1, DGR_MSGTYP_PARTIAL_UPDATE, DGR_ITEM_LIGHT_FADE, fade, DGR_ITEM_LIGHT_SPEED, speed);
     }
+  }
 
-    if (power_state != previous_power_state
-      ||red != previous_red
-      || green != previous_green
-      || blue != previous_blue
-      || warm_white != previous_warm_white
-      || cold_white != previous_cold_white
-      || brightness != previous_brightness
-      || color_brightness != previous_color_brightness
-      || color_mode != previous_color_mode
-    ) {
-    uint8_t light_channels[6] = {
-      (uint8_t)(red * 255),
-      (uint8_t)(green * 255),
-      (uint8_t)(blue * 255),
-      (uint8_t)(cold_white * 255),
-      (uint8_t)(warm_white * 255),
-      0
-    };
-
-    SendDeviceGroupMessage(1, (DevGroupMessageType) (DGR_MSGTYP_UPDATE),
-                          DGR_ITEM_LIGHT_CHANNELS, light_channels);
+  // While a shared scheme runs, every member runs the matching effect itself, so the colors the
+  // effect steps through aren't sent.
+  bool scheme_running = false;
+  if (!this->schemes_.empty()) {
+    uint8_t scheme = get_light_scheme(obj);
+    if (device_group && scheme != device_group->light_scheme) {
+      device_group->light_scheme = scheme;
+      SendDeviceGroupMessage(1, DGR_MSGTYP_UPDATE, DGR_ITEM_LIGHT_SCHEME, scheme);
     }
+    scheme_running = (scheme != 0);
+  }
 
-    if (brightness != previous_brightness) {
+  if (!scheme_running && (power_state != light.previous_power_state || brightness != light.previous_brightness ||
+                          memcmp(light_channels, light.previous_light_channels, sizeof(light_channels)))) {
+    SendDeviceGroupMessage(1, (DevGroupMessageType) (DGR_MSGTYP_UPDATE), DGR_ITEM_LIGHT_CHANNELS, light_channels);
+  }
+
+  if (!scheme_running && brightness != light.previous_brightness) {
     SendDeviceGroupMessage(1, (DevGroupMessageType) (DGR_MSGTYP_UPDATE + DGR_MSGTYPFLAG_WITH_LOCAL),
-                          DGR_ITEM_LIGHT_BRI, (uint8_t)(brightness * 255));
+                           DGR_ITEM_LIGHT_BRI, brightness);
+  }
+
+  light.previous_power_state = power_state;
+  light.previous_brightness = brightness;
+  memcpy(light.previous_light_channels, light_channels, sizeof(light_channels));
+}
+
+// Times the transitions local changes start. ESPHome doesn't tell listeners how long a call's
+// transition is, so the next local change tells the group the length the last one took.
+void device_groups::on_light_target_state_reached(struct device_group_light &light) {
+  if (light.transition_start_time) {
+    light.transition_length = millis() - light.transition_start_time;
+    light.transition_start_time = 0;
+  }
+}
+
+// Returns the Tasmota scheme mapped to the light's running effect, or 0 if there is none.
+uint8_t device_groups::get_light_scheme(light::LightState *obj) {
+  std::string effect = obj->get_effect_name();
+  for (auto &scheme : this->schemes_) {
+    if (!strcasecmp(scheme.second, effect.c_str()))
+      return scheme.first;
+  }
+  return 0;
+}
+
+// Returns the effect mapped to a Tasmota scheme if the light has it, or "None" to stop any effect.
+std::string device_groups::get_scheme_effect(light::LightState *obj, uint8_t scheme) {
+  for (auto &mapping : this->schemes_) {
+    if (mapping.first != scheme)
+      continue;
+    for (light::LightEffect *effect : obj->get_effects()) {
+      if (!strcasecmp(effect->get_name().c_str(), mapping.second))
+        return effect->get_name();
     }
+  }
+  return "None";
+}
+
+// Tasmota's Speed sets the length of transitions in half seconds. A light's is the length of its
+// last local transition.
+uint8_t device_groups::get_light_speed(const struct device_group_light &light) {
+  uint32_t speed = (light.transition_length + DGR_LIGHT_SPEED_STEP / 2) / DGR_LIGHT_SPEED_STEP;
+  if (speed < 1)
+    speed = 1;
+  else if (speed > DGR_LIGHT_SPEED_MAX)
+    speed = DGR_LIGHT_SPEED_MAX;
+  return speed;
+}
+
+// Returns the transition length for a light change received for a group, or -1 to use the light's
+// default when the group hasn't shared its fade settings.
+int32_t device_groups::get_light_transition_length(const struct device_group *device_group) {
+  if (TasmotaGlobal.skip_light_fade || !device_group->light_fade)
+    return 0;
+  if (device_group->light_fade < 0 || device_group->light_speed <= 0)
+    return -1;
+  return device_group->light_speed * DGR_LIGHT_SPEED_STEP;
+}
+
+// Looks up which color channels a light has once, so updates don't have to go through its traits.
+// White channels are matched in the same order as the light's color modes are preferred: color
+// temperature, then cold/warm white, then a single white channel.
+void device_groups::init_light_descriptor(light::LightState *obj, struct device_group_light *light) {
+  light::LightTraits traits = obj->get_traits();
+  light->obj = obj;
+  light->call = obj->make_call();
+  light->call_pending = false;
+  light->call_brightness = -1;
+  light->call_color_mode = light::ColorMode::UNKNOWN;
+  light->remote_origin = false;
+  light->transition_start_time = 0;
+  light->transition_length = obj->get_default_transition_length();
+  light->rgb = traits.supports_color_capability(light::ColorCapability::RGB);
+  light->white = DGR_LIGHT_WHITE_NONE;
+  light->white_capability = light::ColorCapability::WHITE;
+  light->min_mireds = light->mireds_range = 0;
+  if (traits.supports_color_capability(light::ColorCapability::COLOR_TEMPERATURE)) {
+    light->white = DGR_LIGHT_WHITE_CT;
+    light->white_capability = light::ColorCapability::COLOR_TEMPERATURE;
+    light->min_mireds = (uint16_t) (traits.get_min_mireds() + 0.5f);
+    light->mireds_range = (uint16_t) (traits.get_max_mireds() + 0.5f) - light->min_mireds;
+  } else if (traits.supports_color_capability(light::ColorCapability::COLD_WARM_WHITE)) {
+    light->white = DGR_LIGHT_WHITE_CWWW;
+    light->white_capability = light::ColorCapability::COLD_WARM_WHITE;
+  } else if (traits.supports_color_capability(light::ColorCapability::WHITE)) {
+    light->white = DGR_LIGHT_WHITE_SINGLE;
+  }
+}
+
+// Encodes the light's target color as DGR_ITEM_LIGHT_CHANNELS (red, green, blue, cold white, warm
+// white, unused). Channels the current color mode doesn't use are sent as 0.
+void device_groups::get_light_channels(const struct device_group_light &light, uint8_t *light_channels) {
+  const light::LightColorValues &values = light.obj->remote_values;
+  light::ColorMode color_mode = values.get_color_mode();
+  memset(light_channels, 0, 6);
+
+  if (light.rgb && (color_mode & light::ColorCapability::RGB) && values.get_color_brightness() > 0) {
+    light_channels[0] = DeviceGroupLightLevel(values.get_red());
+    light_channels[1] = DeviceGroupLightLevel(values.get_green());
+    light_channels[2] = DeviceGroupLightLevel(values.get_blue());
+  }
 
-    previous_power_state = power_state;
-    previous_brightness = brightness;
-    previous_color_brightness = color_brightness;
-    previous_red = red;
-    previous_green = green;
-    previous_blue = blue;
-    previous_cold_white = cold_white;
-    previous_warm_white = warm_white;
-    previous_color_mode = color_mode;
-  }
-}
-
-void device_groups::get_light_values(light::LightState *obj, bool &power_state, float &brightness, float &color_brightness, float &red, float &green, float &blue, float &cold_white, float &warm_white, esphome::light::ColorMode &color_mode) {
-  power_state = obj->remote_values.is_on();
-  brightness = obj->remote_values.get_brightness();
-  color_brightness = obj->remote_values.get_color_brightness();
-
-  if (obj->get_traits().supports_color_capability(light::ColorCapability::COLOR_TEMPERATURE)) {
-    float min_mireds = 0.0f, max_mireds = 0.0f, color_temperature = 0.0f;
-    color_temperature = obj->remote_values.get_color_temperature();
-    min_mireds = obj->get_traits().get_min_mireds();
-    max_mireds = obj->get_traits().get_max_mireds();
-    warm_white = (color_temperature - min_mireds) / (max_mireds - min_mireds);
-    cold_white = 1.0f - warm_white;
-  } else if (obj->get_traits().supports_color_capability(light::ColorCapability::COLD_WARM_WHITE)) {
-    cold_white = obj->remote_values.get_cold_white();
-    warm_white = obj->remote_values.get_warm_white();
-  } else if (obj->get_traits().supports_color_capability(light::ColorCapability::WHITE)) {
-    warm_white = cold_white = obj->remote_values.get_white();
-  }
-
-  if (obj->get_traits().supports_color_capability(light::ColorCapability::RGB) && color_brightness > 0) {
-    red = obj->remote_values.get_red();
-    green = obj->remote_values.get_green();
-    blue = obj->remote_values.get_blue();
-  }
-
-  color_mode = obj->remote_values.get_color_mode();
-
-  bool has_rgb_mode = color_mode & light::ColorCapability::RGB;
-  bool has_white_mode = color_mode & light::ColorCapability::WHITE
-      || color_mode & light::ColorCapability::COLOR_TEMPERATURE
-      || color_mode & light::ColorCapability::COLD_WARM_WHITE;
-  bool has_rgb_values = red > 0 || green > 0 || blue > 0;
-  bool has_white_values = warm_white > 0 || cold_white > 0;
-
-  if ((!has_rgb_mode && has_rgb_values) || (has_rgb_mode && !has_rgb_values)) {
-    red = green = blue = 0;
-    color_brightness = 0;
-    color_mode = (light::ColorMode)(static_cast<uint8_t>(color_mode) ^ static_cast<uint8_t>(light::ColorCapability::RGB));
-    has_rgb_mode = has_rgb_values = false;
-  }
-
-  if ((!has_white_mode && has_white_values) || (has_white_mode && !has_white_values)) {
-    warm_white = cold_white = 0;
-    color_mode = (light::ColorMode)(static_cast<uint8_t>(color_mode) ^ static_cast<uint8_t>(light::ColorCapability::WHITE));
-    color_mode = (light::ColorMode)(static_cast<uint8_t>(color_mode) ^ static_cast<uint8_t>(light::ColorCapability::COLOR_TEMPERATURE));
-    color_mode = (light::ColorMode)(static_cast<uint8_t>(color_mode) ^ static_cast<uint8_t>(light::ColorCapability::COLD_WARM_WHITE));
-    has_white_mode = has_white_values = false;
-  }
-}
-
-void device_groups::set_light_intial_values(light::LightState *obj) {
-  bool power_state;
-  float brightness, color_brightness, red, green, blue, cold_white, warm_white;
-  esphome::light::ColorMode color_mode = esphome::light::ColorMode::UNKNOWN;
-  get_light_values(obj, power_state, brightness, color_brightness, red, green, blue, cold_white, warm_white, color_mode);
-
-  previous_power_state = power_state;
-  previous_brightness = brightness;
-  previous_color_brightness = color_brightness;
-  previous_red = red;
-  previous_green = green;
-  previous_blue = blue;
-  previous_cold_white = cold_white;
-  previous_warm_white = warm_white;
-  previous_color_mode = color_mode;
+  if (light.white == DGR_LIGHT_WHITE_NONE || !(color_mode & light.white_capability))
+    return;
+  switch (light.white) {
+    case DGR_LIGHT_WHITE_CT: {
+      int32_t mireds = (int32_t) (values.get_color_temperature() + 0.5f) - light.min_mireds;
+      if (mireds < 0)
+        mireds = 0;
+      else if (mireds > light.mireds_range)
+        mireds = light.mireds_range;
+      uint8_t warm_white = light.mireds_range ? (mireds * 255 + light.mireds_range / 2) / light.mireds_range : 0;
+      light_channels[3] = 255 - warm_white;
+      light_channels[4] = warm_white;
+      break;
+    }
+    case DGR_LIGHT_WHITE_CWWW:
+      light_channels[3] = DeviceGroupLightLevel(values.get_cold_white());
+      light_channels[4] = DeviceGroupLightLevel(values.get_warm_white());
+      break;
+    case DGR_LIGHT_WHITE_SINGLE:
+      light_channels[3] = light_channels[4] = DeviceGroupLightLevel(values.get_white());
+      break;
+  }
+}
+
+// Decodes DGR_ITEM_LIGHT_CHANNELS into a light call, using only the channels the light has, and
+// returns the color mode it asks for.
+light::ColorMode device_groups::set_light_channels(const struct device_group_light &light, light::LightCall &call,
+                                                   const uint8_t *light_channels) {
+  const bool has_rgb = light.rgb && (light_channels[0] | light_channels[1] | light_channels[2]);
+  const uint8_t white = (light_channels[3] | light_channels[4]) ? light.white : (uint8_t) DGR_LIGHT_WHITE_NONE;
+  light::ColorMode color_mode = light::ColorMode::ON_OFF | light::ColorMode::BRIGHTNESS;
+  if (has_rgb)
+    color_mode = color_mode | light::ColorCapability::RGB;
+  if (white != DGR_LIGHT_WHITE_NONE)
+    color_mode = color_mode | light.white_capability;
+  call.set_color_mode_if_supported(color_mode);
+
+  if (has_rgb) {
+    call.set_red_if_supported(DeviceGroupLightValue(light_channels[0]));
+    call.set_green_if_supported(DeviceGroupLightValue(light_channels[1]));
+    call.set_blue_if_supported(DeviceGroupLightValue(light_channels[2]));
+  } else {
+    call.set_red_if_supported(0);
+    call.set_green_if_supported(0);
+    call.set_blue_if_supported(0);
+    call.set_color_brightness_if_supported(0);
+  }
+
+  switch (white) {
+    case DGR_LIGHT_WHITE_CT: {
+      // The warm share of the two white channels picks the color temperature.
+      uint32_t total = light_channels[3] + light_channels[4];
+      call.set_color_temperature_if_supported(light.min_mireds +
+                                              (light.mireds_range * light_channels[4] + total / 2) / total);
+      break;
+    }
+    case DGR_LIGHT_WHITE_CWWW:
+      call.set_cold_white_if_supported(DeviceGroupLightValue(light_channels[3]));
+      call.set_warm_white_if_supported(DeviceGroupLightValue(light_channels[4]));
+      break;
+    case DGR_LIGHT_WHITE_SINGLE:
+      call.set_white_if_supported(
+          DeviceGroupLightValue(light_channels[3] > light_channels[4] ? light_channels[3] : light_channels[4]));
+      break;
+    default:
+      call.set_white_if_supported(0);
+      break;
+  }
+  return color_mode;
+}
+
+void device_groups::set_light_intial_values(struct device_group_light &light) {
+  light.previous_power_state = light.obj->remote_values.is_on();
+  light.previous_brightness = DeviceGroupLightLevel(light.obj->remote_values.get_brightness());
+  get_light_channels(light, light.previous_light_channels);
 }
 #endif
 
 void device_groups::dump_config() {
-  ESP_LOGCONFIG(TAG, "Device Group %s configuration:", this->device_group_name_.c_str());
+  for (uint32_t index = 0; index < this->device_group_names_.size(); index++) {
+    const char *group_name = this->device_group_names_[index];
+    if (this->multiple_device_groups_) {
+      ESP_LOGCONFIG(TAG, "Device Group %s configuration (relay %u):", group_name, index + 1);
+    } else {
+      ESP_LOGCONFIG(TAG, "Device Group %s configuration:", group_name);
+    }
+    // Before any traffic; DevGroupStatus reports what the group uses once it's running. The message
+    // buffer starts with room for the header alone and grows with the updates sent, up to a full
+    // packet.
+    uint32_t message_size = sizeof(DEVICE_GROUP_MESSAGE) + strlen(group_name) + 5;
+    ESP_LOGCONFIG(TAG, " - Base RAM: %u bytes, up to %u with a full-size message",
+                  (unsigned) (sizeof(struct device_group) + message_size),
+                  (unsigned) (sizeof(struct device_group) + DGR_MAX_MESSAGE_SIZE));
+    ESP_LOGCONFIG(TAG, "   (%u group, %u-%u message, %u per member)", (unsigned) sizeof(struct device_group),
+                  (unsigned) message_size, (unsigned) DGR_MAX_MESSAGE_SIZE,
+                  (unsigned) sizeof(struct device_group_member));
+  }
   ESP_LOGCONFIG(TAG, " - Send Mask: 0x%08x", send_mask_);
   ESP_LOGCONFIG(TAG, " - Receive Mask: 0x%08x", receive_mask_);
+  ESP_LOGCONFIG(TAG, " - Max Ack Delay: %ums", max_ack_delay_);
+  ESP_LOGCONFIG(TAG, " - Max Packets Per Loop: %u", max_loop_packets_);
+  ESP_LOGCONFIG(TAG, " - Max Loop Time: %uus", max_loop_time_);
 #ifdef USE_SWITCH
   ESP_LOGCONFIG(TAG, "Switches:");
   if (this->switches_.empty()) {
@@ -255,11 +729,19 @@ void device_groups::loop() {
 }
 
 void device_groups::DeviceGroupsInit() {
+  // Each configured group name is a device group. With relays in separate device groups, group N
+  // follows relay N.
+  device_group_count = this->device_group_names_.size();
+  if (device_group_count > MAX_DEV_GROUP_NAMES)
+    device_group_count = MAX_DEV_GROUP_NAMES;
+  for (uint32_t device_group_index = 0; device_group_index < device_group_count; device_group_index++)
+    Settings.device_group_tie[device_group_index] = device_group_index + 1;
+
   // If no module set the device group count, ...
   if (!device_group_count) {
     // If relays in separate device groups is enabled, set the device group count to highest numbered
     // button.
-    /*if (Settings->flag4.multiple_device_groups) {  // SetOption88 - Enable relays in separate device groups
+    /*if (Settings.flag4.multiple_device_groups) {  // SetOption88 - Enable relays in separate device groups
       for (uint32_t relay_index = 0; relay_index < MAX_RELAYS; relay_index++) {
         if (PinUsed(GPIO_REL1, relay_index)) device_group_count = relay_index + 1;
       }
@@ -298,23 +780,38 @@ void device_groups::DeviceGroupsInit() {
     device_group_index + 1);
       }
     }*/
-    strcpy(device_group->group_name, this->device_group_name_.c_str());
+
+    // The group name is only kept in the message header. Start with a message buffer big enough for
+    // the header, sequence, flags and EOL. It grows when an update needs more room.
+    const char *group_name = this->device_group_names_[device_group_index];
+    device_group->message_size = sizeof(DEVICE_GROUP_MESSAGE) + strlen(group_name) + 5;
+    device_group->message = (uint8_t *) malloc(device_group->message_size);
+    if (!device_group->message) {
+      ESP_LOGE(TAG, "Error allocating %u-byte message", device_group->message_size);
+      while (device_group-- > device_groups_)
+        free(device_group->message);
+      free(device_groups_);
+      device_groups_ = nullptr;
+      return;
+    }
     device_group->message_header_length =
-        sprintf_P((char *) device_group->message, PSTR("%s%s"), kDeviceGroupMessage, device_group->group_name) + 1;
+        sprintf_P((char *) device_group->message, PSTR("%s%s"), kDeviceGroupMessage, group_name) + 1;
     device_group->no_status_share = 0;
     device_group->last_full_status_sequence = -1;
+    device_group->status_cache_valid = false;
+    device_group->light_fade = device_group->light_speed = device_group->light_scheme = -1;
   }
 
   // If both in and out shared items masks are 0, assume they're unitialized and initialize them.
-  if (!Settings->device_group_share_in && !Settings->device_group_share_out) {
-    Settings->device_group_share_in = Settings->device_group_share_out = 0xffffffff;
+  if (!Settings.device_group_share_in && !Settings.device_group_share_out) {
+    Settings.device_group_share_in = Settings.device_group_share_out = 0xffffffff;
   }
 
   device_groups_initialized = true;
 }
 
 bool device_groups::DeviceGroupsStart() {
-  if (Settings->flag4.device_groups_enabled && !device_groups_up && !TasmotaGlobal.restart_flag) {
+  if (Settings.flag4.device_groups_enabled && !device_groups_up && !TasmotaGlobal.restart_flag) {
     // If we haven't successfuly initialized device groups yet, attempt to do it now.
     if (!device_groups_initialized) {
       DeviceGroupsInit();
@@ -336,20 +833,37 @@ bool device_groups::DeviceGroupsStart() {
 #endif
     device_groups_up = true;
 
+    // Members name us by this address in the acks they piggyback on their updates.
+#if defined(USE_DEVICE_GROUPS_SIM)
+    local_ip_ = device_groups_udp.localIP();
+#elif defined(USE_ESP_IDF)
+    local_ip_ = IPAddress();
+    inet_pton(AF_INET, device_groups_udp.localIP(), local_ip_.bytes);
+#else
+    local_ip_ = WiFi.localIP();
+#endif
+
     // The WiFi was down but now it's up and device groups is initialized. (Re-)discover devices in
     // our device group(s). Load the status request message for all device groups. This message will
-    // be multicast 10 times at 200ms intervals.
-    next_check_time = millis() + 2000;
+    // be multicast up to DGR_STATUS_REQUEST_COUNT times at jittered intervals, starting at a random
+    // time so devices that all came back from the same power cut don't ask in lock-step.
+    uint32_t now = DeviceGroupsMillis();
+    next_check_time = now + DGR_DISCOVERY_DELAY + DGR_DISCOVERY_JITTER;
     struct device_group *device_group = device_groups_;
     for (uint32_t device_group_index = 0; device_group_index < device_group_count;
          device_group_index++, device_group++) {
       device_group->next_announcement_time = -1;
+      device_group->status_response_time = 0;
+      ClearDeviceGroupUpdate(&device_group->update);
       device_group->message_length =
           BeginDeviceGroupMessage(device_group, DGR_FLAG_RESET | DGR_FLAG_STATUS_REQUEST) - device_group->message;
-      device_group->initial_status_requests_remaining = 10;
-      device_group->next_ack_check_time = next_check_time;
+      device_group->initial_status_requests_remaining = DGR_STATUS_REQUEST_COUNT;
+      device_group->status_request_postponed = false;
+      device_group->next_ack_check_time = now + DGR_DISCOVERY_DELAY + (DeviceGroupsRandom() % DGR_DISCOVERY_JITTER);
+      if ((int32_t) (next_check_time - device_group->next_ack_check_time) > 0)
+        next_check_time = device_group->next_ack_check_time;
+      ESP_LOGD(TAG, "%s (Re)discovering members", DeviceGroupName(device_group));
     }
-    ESP_LOGD(TAG, "%s (Re)discovering members", this->device_group_name_.c_str());
   }
 
   return true;
@@ -357,6 +871,7 @@ bool device_groups::DeviceGroupsStart() {
 
 void device_groups::DeviceGroupsStop() {
   device_groups_udp.flush();
+  device_groups_udp_packet_waiting = false;
   device_groups_up = false;
 }
 
@@ -367,6 +882,7 @@ void device_groups::SendReceiveDeviceGroupMessage(struct device_group *device_gr
   uint16_t message_sequence;
   uint16_t flags;
   int device_group_index = device_group - device_groups_;
+  uint32_t original_no_status_share = device_group->no_status_share;
   int log_length;
   int log_remaining;
   char *log_ptr;
@@ -382,11 +898,15 @@ void device_groups::SendReceiveDeviceGroupMessage(struct device_group *device_gr
   message_sequence |= *message_ptr++ << 8;
   flags = *message_ptr++;
   flags |= *message_ptr++ << 8;
+  if (received)
+    DGR_TRACE(DGR_TRACE_DECODE, device_group_index, message_sequence,
+              (device_group_member ? DeviceGroupTraceAddress(device_group_member->ip_address) : 0),
+              flags << 16 | message_length);
 
   // Initialize the log buffer.
   char *log_buffer = (char *) malloc(512);
   log_length = sprintf(log_buffer, PSTR("%s %s message %s %s: seq=%u, flags=%u"),
-                       (received ? PSTR("Received") : PSTR("Sending")), device_group->group_name,
+                       (received ? PSTR("Received") : PSTR("Sending")), DeviceGroupName(device_group),
                        (received ? PSTR("from") : PSTR("to")),
                        (device_group_member ? IPAddressToString(device_group_member->ip_address)
                         : received          ? PSTR("local")
@@ -402,21 +922,39 @@ void device_groups::SendReceiveDeviceGroupMessage(struct device_group *device_gr
   // If this is a received ack message, save the message sequence if it's newer than the last ack we
   // received from this member.
   if (flags == DGR_FLAG_ACK) {
-    if (received && device_group_member &&
-        (message_sequence > device_group_member->acked_sequence ||
-         device_group_member->acked_sequence - message_sequence < 64536)) {
-      device_group_member->acked_sequence = message_sequence;
+    if (received)
+      DGR_TRACE(DGR_TRACE_ACK, device_group_index, message_sequence,
+                (device_group_member ? DeviceGroupTraceAddress(device_group_member->ip_address) : 0), 0);
+    if (received && device_group_member) {
+#ifdef USE_DEVICE_GROUPS_STATS
+      if (device_group->stats.update_pending) {
+        device_group->stats.update_packets++;
+        device_group->stats.update_bytes += message_length + DGR_IP_AND_UDP_HEADER_SIZE;
+      }
+#endif  // USE_DEVICE_GROUPS_STATS
+      SetDeviceGroupMemberAcked(device_group, device_group_member, message_sequence);
     }
     goto write_log;
   }
 
-  // If this is a received message, send an ack message to the sender.
+  // If this is a received message, send an ack message to the sender, at once or after a delay.
   if (device_group_member) {
     if (received) {
-      if (!(flags & DGR_FLAG_MORE_TO_COME)) {
-        *(message_ptr - 2) = DGR_FLAG_ACK;
-        *(message_ptr - 1) = 0;
-        SendReceiveDeviceGroupMessage(device_group, device_group_member, message, message_ptr - message, false);
+      // The last message of a split update is only acked once all its parts are in, so the sender
+      // resends the parts we missed along with it.
+      uint16_t chain_start = DeviceGroupChainStart(message_ptr, message_end_ptr);
+      if (chain_start && !DeviceGroupChainReceived(device_group_member, chain_start, message_sequence)) {
+        log_length = snprintf(log_ptr, log_remaining, PSTR(" (parts missing)"));
+        log_ptr += log_length;
+        log_remaining -= log_length;
+      } else if (!(flags & DGR_FLAG_MORE_TO_COME)) {
+        if (max_ack_delay_) {
+          ScheduleDeviceGroupAck(device_group, device_group_member, message_sequence);
+        } else {
+          *(message_ptr - 2) = DGR_FLAG_ACK;
+          *(message_ptr - 1) = 0;
+          SendReceiveDeviceGroupMessage(device_group, device_group_member, message, message_ptr - message, false);
+        }
       }
     }
 
@@ -429,24 +967,69 @@ void device_groups::SendReceiveDeviceGroupMessage(struct device_group *device_gr
     }
   }
 
+  // A member that restarted starts its sequence over, so forget the ones it used before.
+  if (received && device_group_member && (flags & DGR_FLAG_RESET))
+    device_group_member->received_window = 0;
+
   // If this is a status request message, skip item processing.
   if ((flags & DGR_FLAG_STATUS_REQUEST))
     goto write_log;
 
   // If this is a received message, ...
   if (received) {
-    // If we already processed this or a later message from this group member, ignore this message.
+    // Each message is processed once. The member's messages are tracked in a window of the last
+    // DGR_RECEIVE_WINDOW sequences, so one that arrives out of order is still recognized.
     if (device_group_member) {
-      if (message_sequence <= device_group_member->received_sequence) {
-        if (message_sequence == device_group_member->received_sequence ||
-            device_group_member->received_sequence - message_sequence > 64536) {
+      int16_t offset = device_group_member->received_sequence - message_sequence;
+      if (!device_group_member->received_window || offset < 0 || offset >= DGR_RECEIVE_WINDOW) {
+        // This is the member's newest message. One far behind the window means the member
+        // restarted its sequence, so the window starts over.
+        if (device_group_member->received_window && offset < 0 && offset > -DGR_RECEIVE_WINDOW) {
+          device_group_member->received_window <<= -offset;
+          device_group_member->received_chain_window <<= -offset;
+        } else {
+          device_group_member->received_window = 0;
+          device_group_member->received_chain_window = 0;
+        }
+        device_group_member->received_sequence = message_sequence;
+        device_group_member->received_window |= 1;
+        if (flags & DGR_FLAG_MORE_TO_COME)
+          device_group_member->received_chain_window |= 1;
+      } else {
+        // A late complete message is only marked seen, which is safe because updates are
+        // cumulative: a sender only drops an item from its pending update once every member has
+        // acked a message carrying it, and we hadn't acked this one, so the newer messages we already
+        // applied carried all its items too, or newer values of them. Applying it would undo those.
+        // The exception is a more-to-come part of the update the newest message belongs to: the
+        // parts hold different items and aren't resent, so it's applied. That holds while no
+        // complete message was received between them.
+        uint32_t bit = 1U << offset;
+        bool seen = (device_group_member->received_window & bit);
+        device_group_member->received_window |= bit;
+        if (seen || !(flags & DGR_FLAG_MORE_TO_COME) ||
+            (device_group_member->received_window & ~device_group_member->received_chain_window & (bit - 2))) {
           log_length = snprintf(log_ptr, log_remaining, PSTR(" (old)"));
           log_ptr += log_length;
           log_remaining -= log_length;
           goto write_log;
         }
+        device_group_member->received_chain_window |= bit;
+        log_length = snprintf(log_ptr, log_remaining, PSTR(" (late)"));
+        log_ptr += log_length;
+        log_remaining -= log_length;
+      }
+
+      // If we're still (re)discovering members and this is a member's full status, we have the
+      // answer our status requests were asking for, so stop sending them and send our own status.
+      if ((flags & DGR_FLAG_FULL_STATUS) && device_group->initial_status_requests_remaining > 1) {
+        device_group->initial_status_requests_remaining = 1;
+        device_group->next_ack_check_time = DeviceGroupsMillis() + (DeviceGroupsRandom() % DGR_STATUS_REQUEST_JITTER);
+        if ((int32_t) (next_check_time - device_group->next_ack_check_time) > 0)
+          next_check_time = device_group->next_ack_check_time;
+#ifdef DEVICE_GROUPS_DEBUG
+        ESP_LOGD(TAG, "%s Full status received, ending discovery", DeviceGroupName(device_group));
+#endif  // DEVICE_GROUPS_DEBUG
       }
-      device_group_member->received_sequence = message_sequence;
     }
 
     /*
@@ -501,6 +1084,8 @@ void device_groups::SendReceiveDeviceGroupMessage(struct device_group *device_gr
       case DGR_ITEM_NO_STATUS_SHARE:
       case DGR_ITEM_EVENT:
       case DGR_ITEM_LIGHT_CHANNELS:
+      case DGR_ITEM_ACKS:
+      case DGR_ITEM_CHAIN:
         break;
       default:
         ESP_LOGE(TAG, "*** Invalid item=%u", item);
@@ -552,6 +1137,12 @@ void device_groups::SendReceiveDeviceGroupMessage(struct device_group *device_gr
             log_length = snprintf(log_ptr, log_remaining, PSTR("%u,%u,%u,%u,%u,%u"), *message_ptr, *(message_ptr + 1),
                                   *(message_ptr + 2), *(message_ptr + 3), *(message_ptr + 4), *(message_ptr + 5));
             break;
+          case DGR_ITEM_ACKS:
+            log_length = snprintf(log_ptr, log_remaining, PSTR("%u acks"), value / 6);
+            break;
+          case DGR_ITEM_CHAIN:
+            log_length = snprintf(log_ptr, log_remaining, PSTR("from %u"), *message_ptr | *(message_ptr + 1) << 8);
+            break;
         }
       }
       message_ptr += value;
@@ -565,6 +1156,15 @@ void device_groups::SendReceiveDeviceGroupMessage(struct device_group *device_gr
         continue;
       }
 
+      // Acks riding on the update are for us, not an item to share.
+      if (item == DGR_ITEM_ACKS) {
+        if (device_group_member)
+          ProcessDeviceGroupAcks(device_group, device_group_member, (const uint8_t *) XdrvMailbox.data, value);
+        continue;
+      }
+      if (item == DGR_ITEM_CHAIN)
+        continue;
+
       mask = DeviceGroupSharedMask(item);
       if (item_flags & DGR_ITEM_FLAG_NO_SHARE)
         device_group->no_status_share |= mask;
@@ -572,7 +1172,7 @@ void device_groups::SendReceiveDeviceGroupMessage(struct device_group *device_gr
         device_group->no_status_share &= ~mask;
 
       if ((!(device_group->no_status_share & mask) || device_group_member == nullptr) &&
-          (!mask || (mask & Settings->device_group_share_in))) {
+          (!mask || (mask & Settings.device_group_share_in))) {
         item_processed = true;
         XdrvMailbox.command_code = item;
         XdrvMailbox.payload = value;
@@ -581,8 +1181,8 @@ void device_groups::SendReceiveDeviceGroupMessage(struct device_group *device_gr
         log_remaining--;
         switch (item) {
           case DGR_ITEM_POWER:
-            if (Settings->flag4.multiple_device_groups) {  // SetOption88 - Enable relays in separate device groups
-              uint32_t device = Settings->device_group_tie[device_group_index];
+            if (Settings.flag4.multiple_device_groups) {  // SetOption88 - Enable relays in separate device groups
+              uint32_t device = Settings.device_group_tie[device_group_index];
               if (device && device <= TasmotaGlobal.devices_present) {
                 bool on = (value & 1);
                 if (on != ((TasmotaGlobal.power >> (device - 1)) & 1))
@@ -612,143 +1212,43 @@ void device_groups::SendReceiveDeviceGroupMessage(struct device_group *device_gr
             ExecuteCommand(XdrvMailbox.data, SRC_REMOTE);
             break;
           case DGR_ITEM_LIGHT_FADE:
-            TasmotaGlobal.fade = XdrvMailbox.payload;
+            device_group->light_fade = XdrvMailbox.payload;
             break;
           case DGR_ITEM_LIGHT_SPEED:
-            TasmotaGlobal.speed = XdrvMailbox.payload;
+            device_group->light_speed = XdrvMailbox.payload;
             break;
           case DGR_ITEM_LIGHT_SCHEME:
-            TasmotaGlobal.scheme = XdrvMailbox.payload;
+            device_group->light_scheme = XdrvMailbox.payload;
+#ifdef USE_LIGHT
+            if (this->schemes_.empty() || !DeviceGroupHasLights(device_group_index))
+              break;
+            for (struct device_group_light &light : this->light_descriptors_) {
+              light.call.set_effect(get_scheme_effect(light.obj, XdrvMailbox.payload));
+              light.call_pending = true;
+            }
+#endif
             break;
           case DGR_ITEM_LIGHT_FIXED_COLOR:
             break;
           case DGR_ITEM_LIGHT_BRI:
 #ifdef USE_LIGHT
-            for (light::LightState *obj : this->lights_) {
-              auto call = obj->make_call();
-              if (obj->remote_values.get_color_mode() & light::ColorCapability::RGB) {
-                call.set_color_brightness_if_supported(XdrvMailbox.payload / 255.0f);
-              } else {
-                call.set_brightness_if_supported(XdrvMailbox.payload / 255.0f);
-                call.set_color_brightness_if_supported(0);
-              }
-              call.perform();
+            if (!DeviceGroupHasLights(device_group_index))
+              break;
+            // Applied with the rest of the message, once any DGR_ITEM_LIGHT_CHANNELS has set the
+            // color mode it's for.
+            for (struct device_group_light &light : this->light_descriptors_) {
+              light.call_brightness = XdrvMailbox.payload;
+              light.call_pending = true;
             }
 #endif
             break;
           case DGR_ITEM_LIGHT_CHANNELS:
 #ifdef USE_LIGHT
-            for (light::LightState *obj : this->lights_) {
-              auto call = obj->make_call();
-              const float red = (uint8_t) XdrvMailbox.data[0] / 255.0f;
-              const float green = (uint8_t) XdrvMailbox.data[1] / 255.0f;
-              const float blue = (uint8_t) XdrvMailbox.data[2] / 255.0f;
-              const float cold_white = (uint8_t) XdrvMailbox.data[3] / 255.0f;
-              const float warm_white = (uint8_t) XdrvMailbox.data[4] / 255.0f;
-              const bool has_rgb = red + green + blue > 0.0f;
-              const bool has_white = cold_white + warm_white > 0.0f;
-              light::ColorMode color_mode = light::ColorMode::ON_OFF | light::ColorMode::BRIGHTNESS;
-
-              if (has_rgb && obj->get_traits().supports_color_capability(light::ColorCapability::RGB)) {
-                color_mode = color_mode | light::ColorCapability::RGB;
-              }
-
-              if (has_white && obj->get_traits().supports_color_capability(light::ColorCapability::COLOR_TEMPERATURE)) {
-                color_mode = color_mode | light::ColorCapability::COLOR_TEMPERATURE;
-              } else if (has_white && obj->get_traits().supports_color_capability(light::ColorCapability::COLD_WARM_WHITE)) {
-                color_mode = color_mode | light::ColorCapability::COLD_WARM_WHITE;
-              } else if (has_white && obj->get_traits().supports_color_capability(light::ColorCapability::WHITE)) {
-                color_mode = color_mode | light::ColorCapability::WHITE;
-              }
-
-              call.set_color_mode_if_supported(color_mode);
-
-              if (color_mode & light::ColorCapability::RGB) {
-                call.set_red_if_supported(red);
-                call.set_green_if_supported(green);
-                call.set_blue_if_supported(blue);
-              } else {
-                call.set_red_if_supported(0);
-                call.set_green_if_supported(0);
-                call.set_blue_if_supported(0);
-                call.set_color_brightness_if_supported(0);
-              }
-
-              if (has_white && color_mode & light::ColorCapability::COLOR_TEMPERATURE) {
-                call.set_color_temperature_if_supported((warm_white * obj->get_traits().get_max_mireds()) + (cold_white * obj->get_traits().get_min_mireds()));
-              } else if (has_white && color_mode & light::ColorCapability::COLD_WARM_WHITE) {
-                call.set_cold_white_if_supported(cold_white);
-                call.set_warm_white_if_supported(warm_white);
-              } else if (has_white) {
-                call.set_white_if_supported(cold_white > warm_white ? cold_white : warm_white);
-              } else {
-                call.set_white_if_supported(0);
-              }
-
-              call.perform();
-            }
-#endif
-            break;
-          case DGR_ITEM_STATUS:
-#ifdef USE_SWITCH
-            for (switch_::Switch *obj : this->switches_) {
-              SendDeviceGroupMessage(1, (DevGroupMessageType) (DGR_MSGTYP_UPDATE), DGR_ITEM_POWER, obj->state);
-            }
-#endif
-#ifdef USE_LIGHT
-            for (light::LightState *obj : this->lights_) {
-              float red = 0.0f, green = 0.0f, blue = 0.0f, cold_white = 0.0f, warm_white = 0.0f, brightness = 0.0f, color_brightness = 0.0f;
-              brightness = obj->remote_values.get_brightness();
-              color_brightness = obj->remote_values.get_color_brightness();
-
-              if (obj->get_traits().supports_color_capability(light::ColorCapability::COLOR_TEMPERATURE)) {
-                float min_mireds = 0.0f, max_mireds = 0.0f, color_temperature = 0.0f;
-                color_temperature = obj->remote_values.get_color_temperature();
-                min_mireds = obj->get_traits().get_min_mireds();
-                max_mireds = obj->get_traits().get_max_mireds();
-                warm_white = (color_temperature - min_mireds) / (max_mireds - min_mireds);
-                cold_white = 1.0f - warm_white;
-              } else if (obj->get_traits().supports_color_capability(light::ColorCapability::COLD_WARM_WHITE)) {
-                cold_white = obj->remote_values.get_cold_white();
-                warm_white = obj->remote_values.get_warm_white();
-              } else if (obj->get_traits().supports_color_capability(light::ColorCapability::WHITE)) {
-                warm_white = cold_white = obj->remote_values.get_white();
-              }
-
-              if (color_brightness > 0 && obj->get_traits().supports_color_capability(light::ColorCapability::RGB)) {
-                red = obj->remote_values.get_red();
-                green = obj->remote_values.get_green();
-                blue = obj->remote_values.get_blue();
-              }
-
-              auto color_mode = obj->remote_values.get_color_mode();
-
-              if (color_mode == light::ColorMode::RGB) {
-                cold_white = warm_white = 0;
-              } else if (color_mode == light::ColorMode::WHITE
-                        || color_mode == light::ColorMode::COLOR_TEMPERATURE
-                        || color_mode == light::ColorMode::COLD_WARM_WHITE) {
-                red = green = blue = 0;
-                color_brightness = 0;
-              }
-
-              uint8_t light_channels[6] = {
-                (uint8_t)(red * 255),
-                (uint8_t)(green * 255),
-                (uint8_t)(blue * 255),
-                (uint8_t)(cold_white * 255),
-                (uint8_t)(warm_white * 255),
-                0
-              };
-              SendDeviceGroupMessage(1, (DevGroupMessageType) (DGR_MSGTYP_UPDATE_MORE_TO_COME),
-                                    DGR_ITEM_POWER, obj->remote_values.is_on());
-              // If the light is turning off, don't send channel data, as ESPHome will have 0 for all channels in shut-off mode.
-              if (obj->remote_values.is_on()) {
-                SendDeviceGroupMessage(1, (DevGroupMessageType) (DGR_MSGTYP_UPDATE_MORE_TO_COME),
-                                      DGR_ITEM_LIGHT_CHANNELS, light_channels);
-              }
-              SendDeviceGroupMessage(1, (DevGroupMessageType) (DGR_MSGTYP_UPDATE),
-                                    DGR_ITEM_LIGHT_BRI, (uint8_t)(brightness * 255));
+            if (!DeviceGroupHasLights(device_group_index))
+              break;
+            for (struct device_group_light &light : this->light_descriptors_) {
+              light.call_color_mode = set_light_channels(light, light.call, (const uint8_t *) XdrvMailbox.data);
+              light.call_pending = true;
             }
 #endif
             break;
@@ -764,22 +1264,50 @@ void device_groups::SendReceiveDeviceGroupMessage(struct device_group *device_gr
     }
   }
 
+  // Items that change which items we share also change our full status.
+  if (device_group->no_status_share != original_no_status_share)
+    InvalidateDeviceGroupStatus();
+
 write_log:
   *log_ptr++ = 0;
   ESP_LOGD(TAG, "%s", log_buffer);
 
   // If this is a received status request message, then if the requestor didn't just ack our
-  // previous full status update, send a full status update.
+  // previous full status update, schedule a full status update. Requests that arrive before it's
+  // sent are answered by the same multicast, so a group that boots together gets one reply from
+  // each member instead of one per requestor.
   if (received) {
     if ((flags & DGR_FLAG_STATUS_REQUEST)) {
+      // If we're still (re)discovering members, the replies to this request are multicast and will
+      // answer ours too, so hold off our next request. Only once per request, so a crowd of members
+      // rebooting together can't keep postponing it.
+      if (device_group->initial_status_requests_remaining > 1 && !device_group->status_request_postponed) {
+        device_group->status_request_postponed = true;
+        device_group->next_ack_check_time =
+            DeviceGroupsMillis() + DGR_STATUS_REQUEST_INTERVAL + (DeviceGroupsRandom() % DGR_STATUS_REQUEST_JITTER);
+      }
+
       if ((flags & DGR_FLAG_RESET) || device_group_member->acked_sequence != device_group->last_full_status_sequence) {
-        _SendDeviceGroupMessage(-device_group_index, DGR_MSGTYP_FULL_STATUS);
+        if (!device_group->status_response_time) {
+          device_group->status_response_time = DeviceGroupsMillis() + DGR_STATUS_COALESCE_TIME;
+          if ((int32_t) (next_check_time - device_group->status_response_time) > 0)
+            next_check_time = device_group->status_response_time;
+        }
       }
     }
   }
 
   // If this is a message being sent, send it.
   else {
+#ifdef USE_DEVICE_GROUPS_STATS
+    if (device_group->stats.update_pending && message == device_group->message) {
+      device_group->stats.update_packets++;
+      device_group->stats.update_bytes += message_length + DGR_IP_AND_UDP_HEADER_SIZE;
+    }
+#endif  // USE_DEVICE_GROUPS_STATS
+    DGR_TRACE(DGR_TRACE_TX, device_group_index, message_sequence,
+              (device_group_member ? DeviceGroupTraceAddress(device_group_member->ip_address) : 0),
+              flags << 16 | message_length);
     int attempt;
     IPAddress ip_address = (device_group_member ? device_group_member->ip_address : IPAddress(DEVICE_GROUPS_ADDRESS));
     for (attempt = 1; attempt <= 5; attempt++) {
@@ -802,6 +1330,10 @@ badmsg:
 cleanup:
   free(log_buffer);
   if (received) {
+    DGR_TRACE(DGR_TRACE_APPLY, device_group_index, message_sequence,
+              (device_group_member ? DeviceGroupTraceAddress(device_group_member->ip_address) : 0),
+              remote_power_changes_);
+    ApplyRemoteDeviceGroupChanges(device_group);
     TasmotaGlobal.skip_light_fade = false;
     ignore_dgr_sends = false;
   }
@@ -825,9 +1357,9 @@ bool device_groups::_SendDeviceGroupMessage(int32_t device, DevGroupMessageType
   uint8_t device_group_index = -device;
   if (device > 0) {
     device_group_index = 0;
-    if (Settings->flag4.multiple_device_groups) {  // SetOption88 - Enable relays in separate device groups
+    if (Settings.flag4.multiple_device_groups) {  // SetOption88 - Enable relays in separate device groups
       for (; device_group_index < device_group_count; device_group_index++) {
-        if (Settings->device_group_tie[device_group_index] == device)
+        if (Settings.device_group_tie[device_group_index] == device)
           break;
       }
     }
@@ -842,54 +1374,34 @@ bool device_groups::_SendDeviceGroupMessage(int32_t device, DevGroupMessageType
   if (device_group->initial_status_requests_remaining)
     return 1;
 
-    // Load the message header, sequence and flags.
+    // Get the message flags.
 #ifdef DEVICE_GROUPS_DEBUG
-  ESP_LOGD(TAG, "Building %s %spacket", device_group->group_name,
+  ESP_LOGD(TAG, "Building %s %spacket", DeviceGroupName(device_group),
            (message_type == DGR_MSGTYP_FULL_STATUS ? "full status " : ""));
 #endif  // DEVICE_GROUPS_DEBUG
-  uint16_t original_sequence = device_group->outgoing_sequence;
   uint16_t flags = 0;
   if (message_type == DGR_MSGTYP_UPDATE_MORE_TO_COME)
     flags = DGR_FLAG_MORE_TO_COME;
   else if (message_type == DGR_MSGTYP_UPDATE_DIRECT)
     flags = DGR_FLAG_DIRECT;
-  uint8_t *message_ptr = BeginDeviceGroupMessage(device_group, flags,
-                                                 building_status_message || message_type == DGR_MSGTYP_PARTIAL_UPDATE);
 
   // A full status request is a request from a remote device for the status of every item we
   // control. As long as we're building it, we may as well multicast the status update to all
   // device group members.
   if (message_type == DGR_MSGTYP_FULL_STATUS) {
-    device_group->last_full_status_sequence = device_group->outgoing_sequence;
-    device_group->message_length = 0;
+    // Our status items only change when our local state does, so they're built once and reused for
+    // every full status until something invalidates them.
+    if (!device_group->status_cache_valid)
+      BuildDeviceGroupStatus(device_group, device_group_index);
 
-    // Set the flag indicating we're currently building a status message. SendDeviceGroupMessage
-    // will build but not send messages while this flag is set.
-    building_status_message = true;
-
-    // Call the drivers to build the status update.
-    power_t power = TasmotaGlobal.power;
-    if (Settings->flag4.multiple_device_groups) {  // SetOption88 - Enable relays in separate device groups
-      power = (power >> (Settings->device_group_tie[device_group_index] - 1)) & 1;
-    }
-    SendDeviceGroupMessage(-device_group_index, DGR_MSGTYP_PARTIAL_UPDATE, DGR_ITEM_NO_STATUS_SHARE,
-                           device_group->no_status_share, DGR_ITEM_POWER, power);
-    XdrvMailbox.index = 0;
-    if (device_group_index == 0 && first_device_group_is_local)
-      XdrvMailbox.index = DGR_FLAG_LOCAL;
-    XdrvMailbox.command_code = DGR_ITEM_STATUS;
-    XdrvMailbox.topic = (char *) &device_group_index;
-    XdrvCall(FUNC_DEVICE_GROUP_ITEM);
-    building_status_message = false;
+    // The full status replaces whatever update was pending, so later updates carry the status over
+    // to members that haven't acked it yet.
+    ClearDeviceGroupUpdate(&device_group->update);
+    LoadDeviceGroupUpdate(&device_group->update, device_group->status_cache,
+                          device_group->status_cache + device_group->status_cache_length);
 
     // Set the status update flag in the outgoing message.
-    *(message_ptr - 2) |= DGR_FLAG_FULL_STATUS;
-
-    // If we have nothing to share with the other members, just send the EOL item.
-    if (!device_group->message_length) {
-      *message_ptr++ = 0;
-      device_group->message_length = message_ptr - device_group->message;
-    }
+    flags |= DGR_FLAG_FULL_STATUS;
   }
 
   else {
@@ -900,6 +1412,7 @@ bool device_groups::_SendDeviceGroupMessage(int32_t device, DevGroupMessageType
     char oper;
     uint32_t old_value;
     uint8_t *out_ptr = out_buffer;
+    uint8_t *value_ptr;
 #endif  // USE_DEVICE_GROUPS_SEND
     struct item {
       uint8_t item;
@@ -911,8 +1424,7 @@ bool device_groups::_SendDeviceGroupMessage(int32_t device, DevGroupMessageType
     uint8_t item;
     uint32_t mask;
     uint32_t value = 0;
-    uint8_t *value_ptr;
-    uint8_t *first_item_ptr = message_ptr;
+    uint32_t original_no_status_share = device_group->no_status_share;
     struct item *item_ptr;
     va_list ap;
 
@@ -1026,166 +1538,177 @@ bool device_groups::_SendDeviceGroupMessage(int32_t device, DevGroupMessageType
 #endif  // USE_DEVICE_GROUPS_SEND
     item_ptr->item = 0;
 
-    // If we're still building this update or all group members haven't acknowledged the previous
-    // update yet, update the message to include these new updates. First we need to rebuild the
-    // previous update message to remove any items and their values that are included in this new
-    // update.
-    if (device_group->message_length) {
-      uint8_t item_flags = 0;
-      int kept_item_count = 0;
-
-      // Rebuild the previous update message, removing any items whose values are included in this
-      // new update.
-      uint8_t *previous_message_ptr = message_ptr;
-      while ((item = *previous_message_ptr++)) {
-        // If this is the flags item, save the flags.
-        if (item == DGR_ITEM_FLAGS) {
-          item_flags = *previous_message_ptr++;
-        }
-
-        // Otherwise, determine the length of this item's value.
-        else {
-          if (item <= DGR_ITEM_MAX_32BIT) {
-            value = 1;
-            if (item > DGR_ITEM_MAX_8BIT) {
-              value = 2;
-              if (item > DGR_ITEM_MAX_16BIT) {
-                value = 4;
-              }
-            }
-          } else {
-            value = *previous_message_ptr + 1;
-          }
-
-          // Search for this item in the new update.
-          for (item_ptr = item_array; item_ptr->item; item_ptr++) {
-            if (item_ptr->item == item)
-              break;
-          }
-
-          // If this item was not found in the new update, copy it to the new update message. If the
-          // item has flags, first copy the flags item to the new update message.
-          if (!item_ptr->item) {
-            kept_item_count++;
-            if (item_flags) {
-              *message_ptr++ = DGR_ITEM_FLAGS;
-              *message_ptr++ = item_flags;
-            }
-            *message_ptr++ = item;
-            memmove(message_ptr, previous_message_ptr, value);
-            message_ptr += value;
-          }
-          item_flags = 0;
-        }
-
-        // Advance past the item value.
-        previous_message_ptr += value;
-      }
-#ifdef DEVICE_GROUPS_DEBUG
-      ESP_LOGD(TAG, "%u items carried over", kept_item_count);
-#endif  // DEVICE_GROUPS_DEBUG
-    }
-
-    // Itertate through the passed items adding them and their values to the message.
+    // Add the passed items to the pending update. If we're still building this update or all group
+    // members haven't acknowledged the previous update yet, the pending update still holds those
+    // items and these new values replace any previous values of the same items.
     for (item_ptr = item_array; (item = item_ptr->item); item_ptr++) {
-      // If this item is shared with the group add it to the message.
+      // If this item is shared with the group add it to the update.
       shared = true;
       if ((mask = DeviceGroupSharedMask(item))) {
         if (item_ptr->flags & DGR_ITEM_FLAG_NO_SHARE)
           device_group->no_status_share |= mask;
-        else if (!building_status_message)
+        else
           device_group->no_status_share &= ~mask;
         if (message_type != DGR_MSGTYPE_UPDATE_COMMAND) {
           shared = (!(mask & device_group->no_status_share) &&
-                    (device_group_index || (mask & Settings->device_group_share_out)));
+                    (mask & Settings.device_group_share_out));
         }
       }
       if (shared) {
-        if (item_ptr->flags) {
-          *message_ptr++ = DGR_ITEM_FLAGS;
-          *message_ptr++ = item_ptr->flags;
-        }
-        *message_ptr++ = item;
-
-        // For integer items, add the value to the message.
-        if (item <= DGR_ITEM_MAX_32BIT) {
-          value = item_ptr->value;
-          *message_ptr++ = value & 0xff;
-          if (item > DGR_ITEM_MAX_8BIT) {
-            value >>= 8;
-            *message_ptr++ = value & 0xff;
-            if (item > DGR_ITEM_MAX_16BIT) {
-              value >>= 8;
-              *message_ptr++ = value & 0xff;
-              value >>= 8;
-              // For the power item, the device count is overlayed onto the highest 8 bits.
-              if (item == DGR_ITEM_POWER && !value)
-                value =
-                    (!Settings->flag4.multiple_device_groups && device_group_index == 0 && first_device_group_is_local
-                         ? TasmotaGlobal.devices_present
-                         : 1);
-              *message_ptr++ = value;
-            }
-          }
-        }
-
-        // For string items and special items, get the value length.
-        else {
-          if (item <= DGR_ITEM_MAX_STRING) {
-            value = strlen((const char *) item_ptr->value_ptr) + 1;
-          } else {
-            switch (item) {
-              case DGR_ITEM_LIGHT_CHANNELS:
-                value = 6;
-                break;
-            }
-          }
-
-          // Load the length and copy the value.
-          *message_ptr++ = value;
-          memcpy(message_ptr, item_ptr->value_ptr, value);
-          message_ptr += value;
-        }
+        value = item_ptr->value;
+
+        // For the power item, the device count is overlayed onto the highest 8 bits.
+        if (item == DGR_ITEM_POWER && !(value >> 24))
+          value |= (!Settings.flag4.multiple_device_groups && device_group_index == 0 && first_device_group_is_local
+                        ? TasmotaGlobal.devices_present
+                        : 1)
+                   << 24;
+        SetDeviceGroupUpdateItem(&device_group->update, item, item_ptr->flags, value, item_ptr->value_ptr);
       }
     }
 
-    // If we added any items, add the EOL item code and calculate the message length.
-    if (message_ptr != first_item_ptr) {
-      *message_ptr++ = 0;
-      device_group->message_length = message_ptr - device_group->message;
-    }
+    if (device_group->no_status_share != original_no_status_share)
+      InvalidateDeviceGroupStatus();
 
     // If there's going to be more items added to this message, return.
-    if (building_status_message || message_type == DGR_MSGTYP_PARTIAL_UPDATE)
+    if (message_type == DGR_MSGTYP_PARTIAL_UPDATE)
+      return 0;
+
+    // If there is no update, return.
+    if (!device_group->update.present)
       return 0;
   }
 
-  // If there is no message, restore the sequence number and return.
-  if (!device_group->message_length) {
-    device_group->outgoing_sequence = original_sequence;
+  // An item too large for any packet, with room left for the DGR_ITEM_CHAIN item, could never be
+  // sent and would hold up every later update, so drop it.
+  uint32_t max_item_length = DGR_MAX_MESSAGE_SIZE - device_group->message_header_length - 5;
+  for (uint32_t slot = 0; slot < DGR_SLOT_COUNT; slot++) {
+    if ((device_group->update.present & 1 << slot) &&
+        DeviceGroupUpdateItemLength(&device_group->update, slot) > max_item_length - 4) {
+      ESP_LOGE(TAG, "%s item %u too large to send", DeviceGroupName(device_group), DeviceGroupSlotItem(slot));
+      ClearDeviceGroupUpdateSlot(&device_group->update, slot);
+    }
+  }
+  if (!device_group->update.present)
     return 0;
+
+  // Make sure the message buffer can hold the whole update, up to the maximum packet size.
+  uint32_t message_size = device_group->message_header_length + 4 + DeviceGroupUpdateLength(&device_group->update);
+  bool split = (message_size > DGR_MAX_MESSAGE_SIZE);
+  if (device_group->next_ack_send_time)
+    message_size += 2 + DGR_PIGGYBACK_ACKS_MAX * 6;
+  if (message_size > DGR_MAX_MESSAGE_SIZE)
+    message_size = DGR_MAX_MESSAGE_SIZE;
+  if (message_size > device_group->message_size) {
+    uint8_t *message = (uint8_t *) realloc(device_group->message, message_size);
+    if (!message) {
+      ESP_LOGE(TAG, "Error allocating %u-byte message", message_size);
+      return 0;
+    }
+    device_group->message = message;
+    device_group->message_size = message_size;
   }
 
-  // Multicast the packet.
-  device_group->multicasts_remaining = DGR_MULTICAST_REPEAT_COUNT;
-  SendReceiveDeviceGroupMessage(device_group, nullptr, device_group->message, device_group->message_length, false);
+  // The update is only serialized now that it's actually going out. If it doesn't fit in one
+  // packet, it's split into a chain of messages. All but the last message of the chain are flagged
+  // more-to-come and kept in the chain buffer; the last one stays in the message buffer and carries
+  // the sequence the chain starts at. Resends to a member that hasn't acked go through the whole
+  // chain.
+#ifdef USE_DEVICE_GROUPS_STATS
+  if (!device_group->stats.update_pending) {
+    device_group->stats.update_pending = true;
+    device_group->stats.update_start_time = DeviceGroupsMillis();
+    device_group->stats.update_packets = 0;
+    device_group->stats.update_bytes = 0;
+  }
+#endif  // USE_DEVICE_GROUPS_STATS
+  uint8_t slot = 0;
+  uint16_t chain_start = 0;
+  device_group->chain_length = 0;
+  for (;;) {
+    uint8_t *message_ptr = BeginDeviceGroupMessage(device_group, flags);
+    if (!chain_start)
+      chain_start = device_group->outgoing_sequence;
+    message_ptr = SerializeDeviceGroupUpdate(&device_group->update, message_ptr,
+                                             device_group->message + device_group->message_size - (split ? 4 : 0),
+                                             &slot);
+    device_group->message_length = message_ptr - device_group->message;
+    bool more_to_come = (slot < DGR_SLOT_COUNT);
+    if (more_to_come) {
+      // Items that can't fit were dropped above, but never record an update that didn't go out.
+      if (device_group->message_length == device_group->message_header_length + 5) {
+        ESP_LOGE(TAG, "%s item %u too large to send", DeviceGroupName(device_group), DeviceGroupSlotItem(slot));
+        return 0;
+      }
+      device_group->message[device_group->message_header_length + 2] |= DGR_FLAG_MORE_TO_COME;
+      AddDeviceGroupChainMessage(device_group);
+    }
 
-#ifdef USE_DEVICE_GROUPS_SEND
-  // If requested, handle this updated locally as well.
-  if (with_local) {
-    struct XDRVMAILBOX save_XdrvMailbox = XdrvMailbox;
-    SendReceiveDeviceGroupMessage(device_group, nullptr, device_group->message, device_group->message_length, true);
-    XdrvMailbox = save_XdrvMailbox;
+    // The last message of a split update says where the chain starts.
+    else if (split) {
+      const uint8_t chain_item[2] = {(uint8_t) (chain_start & 0xff), (uint8_t) (chain_start >> 8)};
+      message_ptr = AppendDeviceGroupItem(message_ptr - 1, DGR_ITEM_CHAIN, chain_item, sizeof(chain_item));
+      *message_ptr++ = DGR_ITEM_EOL;
+      device_group->message_length = message_ptr - device_group->message;
+    }
+
+    // The acks we're holding ride on the last message of the update.
+    uint32_t acks_offset = 0;
+    if (!more_to_come && device_group->next_ack_send_time) {
+      acks_offset = device_group->message_length;
+      message_ptr =
+          AppendDeviceGroupAcks(device_group, message_ptr, device_group->message + device_group->message_size);
+      device_group->message_length = message_ptr - device_group->message;
+    }
+
+    // Multicast the packet.
+    SendReceiveDeviceGroupMessage(device_group, nullptr, device_group->message, device_group->message_length, false);
+
+    // If requested, handle this updated locally as well.
+    if (with_local) {
+      struct XDRVMAILBOX save_XdrvMailbox = XdrvMailbox;
+      SendReceiveDeviceGroupMessage(device_group, nullptr, device_group->message, device_group->message_length, true);
+      XdrvMailbox = save_XdrvMailbox;
+    }
+
+    // The acks are only good for this send. Take them off again so retransmits don't carry stale
+    // ones; a member whose ack went out on a lost packet resends and gets acked again.
+    if (acks_offset && device_group->message_length != acks_offset) {
+      device_group->message_length = acks_offset;
+      device_group->message[acks_offset - 1] = DGR_ITEM_EOL;
+    }
+
+    if (!more_to_come)
+      break;
   }
-#endif  // USE_DEVICE_GROUPS_SEND
+  device_group->multicasts_remaining = DGR_MULTICAST_REPEAT_COUNT;
+  if (message_type == DGR_MSGTYP_FULL_STATUS)
+    device_group->last_full_status_sequence = device_group->outgoing_sequence;
 
-  uint32_t now = millis();
+  uint32_t now = DeviceGroupsMillis();
   if (message_type == DGR_MSGTYP_UPDATE_MORE_TO_COME) {
+    ClearDeviceGroupUpdate(&device_group->update);
     device_group->message_length = 0;
     device_group->next_ack_check_time = 0;
   } else {
+    // Note the message that carries each changed item, and when this update went out.
+    for (uint32_t slot = 0; slot < DGR_SLOT_COUNT; slot++) {
+      if (device_group->update.changed & 1 << slot)
+        device_group->update_sequences[slot] = device_group->outgoing_sequence;
+    }
+    device_group->update.changed = 0;
+    struct device_group_in_flight *in_flight =
+        &device_group->in_flight[device_group->in_flight_index++ % DGR_MAX_IN_FLIGHT];
+    in_flight->sequence = device_group->outgoing_sequence;
+    in_flight->send_time = now;
+
+    // If earlier updates are still waiting for acks, keep the check that's due for them, even if
+    // it's due now, so members that missed them are resent the update and the items everyone has
+    // are pruned even while changes keep coming.
     device_group->ack_check_interval = DGR_ACK_WAIT_TIME;
-    device_group->next_ack_check_time = now + device_group->ack_check_interval;
+    if (!device_group->next_ack_check_time ||
+        (int32_t) (device_group->next_ack_check_time - (now + device_group->ack_check_interval)) > 0)
+      device_group->next_ack_check_time = now + device_group->ack_check_interval;
     if ((int32_t) (next_check_time - device_group->next_ack_check_time) > 0)
       next_check_time = device_group->next_ack_check_time;
     device_group->member_timeout_time = now + DGR_MEMBER_TIMEOUT;
@@ -1197,13 +1720,98 @@ bool device_groups::_SendDeviceGroupMessage(int32_t device, DevGroupMessageType
   return 0;
 }
 
+void device_groups::BuildDeviceGroupStatus(struct device_group *device_group, uint8_t device_group_index) {
+  uint8_t status_buffer[64];
+  uint8_t *status_ptr = status_buffer;
+  auto shared = [&](uint8_t item) {
+    uint32_t mask = DeviceGroupSharedMask(item);
+    return !(mask & device_group->no_status_share) && (mask & Settings.device_group_share_out);
+  };
+
+  status_ptr = AppendDeviceGroupItem(status_ptr, DGR_ITEM_NO_STATUS_SHARE, device_group->no_status_share);
+
+  // For the power item, the device count is overlayed onto the highest 8 bits.
+  if (shared(DGR_ITEM_POWER)) {
+    power_t power = TasmotaGlobal.power;
+    uint32_t power_devices = 1;
+    if (Settings.flag4.multiple_device_groups) {  // SetOption88 - Enable relays in separate device groups
+      power = (power >> (Settings.device_group_tie[device_group_index] - 1)) & 1;
+    } else if (device_group_index == 0 && first_device_group_is_local) {
+      power_devices = TasmotaGlobal.devices_present;
+    }
+    status_ptr = AppendDeviceGroupItem(status_ptr, DGR_ITEM_POWER, (power & 0xffffff) | power_devices << 24);
+  }
+
+#ifdef USE_LIGHT
+  // A message holds one value per item, so it can only describe one light, and the config allows
+  // no more than that.
+  if (!this->light_descriptors_.empty() && DeviceGroupHasLights(device_group_index)) {
+    const struct device_group_light &light = this->light_descriptors_.front();
+    light::LightState *obj = light.obj;
+    uint8_t light_channels[6];
+    uint8_t brightness = DeviceGroupLightLevel(obj->remote_values.get_brightness());
+    get_light_channels(light, light_channels);
+
+    // If the light is off, don't send channel data, as ESPHome will have 0 for all channels in shut-off mode.
+    if (obj->remote_values.is_on() && shared(DGR_ITEM_LIGHT_CHANNELS))
+      status_ptr = AppendDeviceGroupItem(status_ptr, DGR_ITEM_LIGHT_CHANNELS, light_channels, sizeof(light_channels));
+    if (shared(DGR_ITEM_LIGHT_BRI))
+      status_ptr = AppendDeviceGroupItem(status_ptr, DGR_ITEM_LIGHT_BRI, brightness);
+    if (!this->schemes_.empty() && shared(DGR_ITEM_LIGHT_SCHEME))
+      status_ptr = AppendDeviceGroupItem(status_ptr, DGR_ITEM_LIGHT_SCHEME, get_light_scheme(obj));
+    if (shared(DGR_ITEM_LIGHT_FADE)) {
+      uint8_t fade = (device_group->light_fade >= 0 ? device_group->light_fade : light.transition_length > 0);
+      uint8_t speed = (device_group->light_speed > 0 ? device_group->light_speed : get_light_speed(light));
+      status_ptr = AppendDeviceGroupItem(status_ptr, DGR_ITEM_LIGHT_FADE, fade);
+      status_ptr = AppendDeviceGroupItem(status_ptr, DGR_ITEM_LIGHT_SPEED, speed);
+    }
+  }
+#endif
+
+  // Keep the status in a buffer of just the size it needs.
+  uint8_t status_length = status_ptr - status_buffer;
+  uint8_t *status_cache = (uint8_t *) realloc(device_group->status_cache, status_length);
+  if (!status_cache) {
+    ESP_LOGE(TAG, "Error allocating %u-byte status", status_length);
+    device_group->status_cache_length = 0;
+    return;
+  }
+  memcpy(status_cache, status_buffer, status_length);
+  device_group->status_cache = status_cache;
+  device_group->status_cache_length = status_length;
+  device_group->status_cache_valid = true;
+}
+
+// Lights follow relay 1, so only the group tied to it carries light items.
+bool device_groups::DeviceGroupHasLights(uint8_t device_group_index) {
+  return !Settings.flag4.multiple_device_groups || Settings.device_group_tie[device_group_index] == 1;
+}
+
+// Returns the group lights follow, or nullptr if there is none yet.
+struct device_group *device_groups::LightDeviceGroup() {
+  if (!device_groups_initialized)
+    return nullptr;
+  for (uint32_t device_group_index = 0; device_group_index < device_group_count; device_group_index++) {
+    if (DeviceGroupHasLights(device_group_index))
+      return &device_groups_[device_group_index];
+  }
+  return nullptr;
+}
+
+void device_groups::InvalidateDeviceGroupStatus() {
+  if (!device_groups_initialized)
+    return;
+  for (uint32_t device_group_index = 0; device_group_index < device_group_count; device_group_index++)
+    device_groups_[device_group_index].status_cache_valid = false;
+}
+
 ProcessGroupMessageResult device_groups::ProcessDeviceGroupMessage(multicast_packet packet) {
   // Search for a device group with the target group name. If one isn't found, return.
   uint8_t device_group_index = 0;
   struct device_group *device_group = device_groups_;
-  char *message_group_name = (char *) packet.payload + sizeof(DEVICE_GROUP_MESSAGE) - 1;
   for (;;) {
-    if (!strcmp(message_group_name, device_group->group_name))
+    if (packet.length > device_group->message_header_length &&
+        !memcmp(packet.payload, device_group->message, device_group->message_header_length))
       break;
     if (++device_group_index >= device_group_count)
       return PROCESS_GROUP_MESSAGE_UNMATCHED;
@@ -1223,9 +1831,10 @@ ProcessGroupMessageResult device_groups::ProcessDeviceGroupMessage(multicast_pac
       }
       device_group_member->ip_address = packet.remoteIP;
       device_group_member->acked_sequence = device_group->outgoing_sequence;
-      device_group->member_timeout_time = millis() + DGR_MEMBER_TIMEOUT;
+      device_group->member_timeout_time = DeviceGroupsMillis() + DGR_MEMBER_TIMEOUT;
       *flink = device_group_member;
-      ESP_LOGD(TAG, "%s Member %s added", device_group->group_name, IPAddressToString(packet.remoteIP));
+      DGR_TRACE(DGR_TRACE_MEMBER_ADD, device_group_index, 0, DeviceGroupTraceAddress(packet.remoteIP), 0);
+      ESP_LOGD(TAG, "%s Member %s added", DeviceGroupName(device_group), IPAddressToString(packet.remoteIP));
       break;
     } else if (device_group_member->ip_address == packet.remoteIP) {
       break;
@@ -1238,88 +1847,398 @@ ProcessGroupMessageResult device_groups::ProcessDeviceGroupMessage(multicast_pac
 }
 
 void device_groups::DeviceGroupStatus(uint8_t device_group_index) {
-  if (Settings->flag4.device_groups_enabled && device_group_index < device_group_count) {
+  if (Settings.flag4.device_groups_enabled && device_group_index < device_group_count) {
     char buffer[1024];
     int member_count = 0;
     struct device_group *device_group = &device_groups_[device_group_index];
+    uint32_t ram = sizeof(struct device_group) + device_group->message_size + device_group->status_cache_length +
+                   device_group->chain_length;
+    for (const char *string : device_group->update.strings) {
+      if (string)
+        ram += strlen(string) + 1;
+    }
+    // Each member is appended after the last, rather than the buffer being printed into itself.
+    size_t length = 0;
     buffer[0] = buffer[1] = 0;
     for (struct device_group_member *device_group_member = device_group->device_group_members; device_group_member;
          device_group_member = device_group_member->flink) {
-      snprintf_P(buffer, sizeof(buffer),
-                 PSTR("%s,{\"IPAddress\":\"%s\",\"ResendCount\":%u,\"LastRcvdSeq\":%u,\"LastAckedSeq\":%u}"), buffer,
-                 IPAddressToString(device_group_member->ip_address), device_group_member->unicast_count,
-                 device_group_member->received_sequence, device_group_member->acked_sequence);
+      ram += sizeof(struct device_group_member);
+      if (length < sizeof(buffer)) {
+        length += snprintf_P(buffer + length, sizeof(buffer) - length,
+                             PSTR(",{\"IPAddress\":\"%s\",\"ResendCount\":%u,\"LastRcvdSeq\":%u,\"LastAckedSeq\":%u}"),
+                             IPAddressToString(device_group_member->ip_address), device_group_member->unicast_count,
+                             device_group_member->received_sequence, device_group_member->acked_sequence);
+      }
       member_count++;
     }
     ESP_LOGI(TAG,
              "{\"" D_CMND_DEVGROUPSTATUS
-             "\":{\"Index\":%u,\"GroupName\":\"%s\",\"MessageSeq\":%u,\"MemberCount\":%d,\"Members\":[%s]}}",
-             device_group_index, device_group->group_name, device_group->outgoing_sequence, member_count, &buffer[1]);
+             "\":{\"Index\":%u,\"GroupName\":\"%s\",\"MessageSeq\":%u,\"MemberCount\":%d,\"RAM\":%u,\"Members\":[%s]}}",
+             device_group_index, DeviceGroupName(device_group), device_group->outgoing_sequence, member_count, ram,
+             &buffer[1]);
+#ifdef USE_DEVICE_GROUPS_STATS
+    LogDeviceGroupConvergence(device_group);
+    ESP_LOGI(TAG, "Most packets read in one loop: %u, most waiting to be matched: %u", packets_per_loop_max_,
+             received_packets_max_);
+#endif  // USE_DEVICE_GROUPS_STATS
+    ESP_LOGI(TAG, "Loop budget hit: %u times on packets, %u times on time", loop_budget_packet_hits_,
+             loop_budget_time_hits_);
   }
 }
 
+// Acks are held for a random time of up to max_ack_delay_ ms, so the members answering one multicast
+// don't all ack at the same instant. A later message from the member before then moves the ack up
+// to its sequence: Tasmota senders only wait for an ack of their latest sequence, and each message
+// carries every change that hasn't been acked yet, so one ack covers them all.
+void device_groups::ScheduleDeviceGroupAck(struct device_group *device_group,
+                                           struct device_group_member *device_group_member, uint16_t sequence) {
+  if (device_group_member->ack_due_time) {
+    if (sequence > device_group_member->pending_ack_sequence ||
+        device_group_member->pending_ack_sequence - sequence > 64536)
+      device_group_member->pending_ack_sequence = sequence;
+    return;
+  }
+
+  device_group_member->pending_ack_sequence = sequence;
+  device_group_member->ack_due_time = DeviceGroupsMillis() + 1 + DeviceGroupsRandom() % max_ack_delay_;
+  if (!device_group->next_ack_send_time ||
+      (int32_t) (device_group->next_ack_send_time - device_group_member->ack_due_time) > 0)
+    device_group->next_ack_send_time = device_group_member->ack_due_time;
+  if ((int32_t) (next_check_time - device_group->next_ack_send_time) > 0)
+    next_check_time = device_group->next_ack_send_time;
+}
+
+void device_groups::SendDueDeviceGroupAcks(struct device_group *device_group, uint32_t now) {
+  uint8_t ack_message[sizeof(DEVICE_GROUP_MESSAGE) + TOPSZ + 4];
+  uint8_t *message_ptr = ack_message + device_group->message_header_length;
+  memcpy(ack_message, device_group->message, device_group->message_header_length);
+  message_ptr[2] = DGR_FLAG_ACK;
+  message_ptr[3] = 0;
+
+  device_group->next_ack_send_time = 0;
+  for (struct device_group_member *device_group_member = device_group->device_group_members; device_group_member;
+       device_group_member = device_group_member->flink) {
+    if (!device_group_member->ack_due_time)
+      continue;
+    if ((int32_t) (now - device_group_member->ack_due_time) >= 0) {
+      device_group_member->ack_due_time = 0;
+      message_ptr[0] = device_group_member->pending_ack_sequence & 0xff;
+      message_ptr[1] = device_group_member->pending_ack_sequence >> 8;
+      SendReceiveDeviceGroupMessage(device_group, device_group_member, ack_message, message_ptr + 4 - ack_message,
+                                    false);
+    } else if (!device_group->next_ack_send_time ||
+               (int32_t) (device_group->next_ack_send_time - device_group_member->ack_due_time) > 0) {
+      device_group->next_ack_send_time = device_group_member->ack_due_time;
+    }
+  }
+}
+
+// Returns true if the update after the one acked_sequence acks is one of the last DGR_MAX_IN_FLIGHT
+// sent and went out less than DGR_ACK_WAIT_TIME ms ago, so its ack may still be on the way.
+bool DeviceGroupUpdatesInFlight(const struct device_group *device_group, uint16_t acked_sequence, uint32_t now) {
+  for (uint32_t index = 0; index < DGR_MAX_IN_FLIGHT; index++) {
+    const struct device_group_in_flight *in_flight = &device_group->in_flight[index];
+    if (in_flight->send_time && in_flight->sequence == acked_sequence) {
+      const struct device_group_in_flight *next_in_flight = &device_group->in_flight[(index + 1) % DGR_MAX_IN_FLIGHT];
+      return ((int16_t) (next_in_flight->sequence - acked_sequence) > 0 &&
+              (int32_t) (now - next_in_flight->send_time) < DGR_ACK_WAIT_TIME);
+    }
+  }
+  return false;
+}
+
+// Drops the items of the pending update that every member has acked a message carrying.
+void PruneDeviceGroupUpdate(struct device_group *device_group) {
+  if (!device_group->device_group_members)
+    return;
+  uint16_t oldest_acked_sequence = device_group->outgoing_sequence;
+  for (struct device_group_member *device_group_member = device_group->device_group_members; device_group_member;
+       device_group_member = device_group_member->flink) {
+    if ((int16_t) (device_group_member->acked_sequence - oldest_acked_sequence) < 0)
+      oldest_acked_sequence = device_group_member->acked_sequence;
+  }
+  for (uint32_t slot = 0; slot < DGR_SLOT_COUNT; slot++) {
+    if ((device_group->update.present & ~device_group->update.changed & 1 << slot) &&
+        (int16_t) (oldest_acked_sequence - device_group->update_sequences[slot]) >= 0)
+      ClearDeviceGroupUpdateSlot(&device_group->update, slot);
+  }
+}
+
+// Sends the more-to-come messages of the update again, ahead of its last message, to a member or,
+// if device_group_member is null, to all of them.
+void device_groups::ResendDeviceGroupChain(struct device_group *device_group,
+                                           struct device_group_member *device_group_member) {
+  for (uint32_t offset = 0; offset + 2 <= device_group->chain_length;) {
+    uint16_t length = device_group->chain[offset] | device_group->chain[offset + 1] << 8;
+    SendReceiveDeviceGroupMessage(device_group, device_group_member, device_group->chain + offset + 2, length, false);
+    offset += 2 + length;
+  }
+}
+
+// Hold-over acks go out as a DGR_ITEM_ACKS item in place of the EOL that message_ptr follows. A
+// member known to read the item needs no separate ack; the others still get theirs when it's due.
+// Tasmota skips items it doesn't know, so they only see the update.
+uint8_t *device_groups::AppendDeviceGroupAcks(struct device_group *device_group, uint8_t *message_ptr,
+                                              const uint8_t *end_ptr) {
+  // If we don't know our address, we couldn't find our acks in a member's reply, so don't start.
+  if (local_ip_ == IPAddress())
+    return message_ptr;
+
+  uint8_t *acks_ptr = message_ptr - 1;
+  uint8_t *entry_ptr = acks_ptr + 2;
+  for (struct device_group_member *device_group_member = device_group->device_group_members; device_group_member;
+       device_group_member = device_group_member->flink) {
+    if (!device_group_member->ack_due_time)
+      continue;
+    if (entry_ptr + 6 + 1 > end_ptr || entry_ptr - acks_ptr - 2 >= DGR_PIGGYBACK_ACKS_MAX * 6)
+      break;
+    for (uint32_t i = 0; i < 4; i++)
+      *entry_ptr++ = device_group_member->ip_address[i];
+    *entry_ptr++ = device_group_member->pending_ack_sequence & 0xff;
+    *entry_ptr++ = device_group_member->pending_ack_sequence >> 8;
+    if (device_group_member->piggyback_acks)
+      device_group_member->ack_due_time = 0;
+  }
+  if (entry_ptr == acks_ptr + 2)
+    return message_ptr;
+
+  acks_ptr[0] = DGR_ITEM_ACKS;
+  acks_ptr[1] = entry_ptr - acks_ptr - 2;
+  *entry_ptr++ = DGR_ITEM_EOL;
+  return entry_ptr;
+}
+
+// A member that sends DGR_ITEM_ACKS reads ours too. The entry it carries for our address acks our
+// updates up to that sequence.
+void device_groups::ProcessDeviceGroupAcks(struct device_group *device_group,
+                                           struct device_group_member *device_group_member, const uint8_t *acks,
+                                           uint8_t length) {
+  device_group_member->piggyback_acks = true;
+  for (; length >= 6; acks += 6, length -= 6) {
+    if (IPAddress(acks[0], acks[1], acks[2], acks[3]) != local_ip_)
+      continue;
+    uint16_t sequence = acks[4] | acks[5] << 8;
+    DGR_TRACE(DGR_TRACE_ACK, device_group - device_groups_, sequence,
+              DeviceGroupTraceAddress(device_group_member->ip_address), 1);
+    SetDeviceGroupMemberAcked(device_group, device_group_member, sequence);
+  }
+}
+
+// Save a member's ack if it's newer than the last one, whether it came on its own or on an update.
+void device_groups::SetDeviceGroupMemberAcked(struct device_group *device_group,
+                                              struct device_group_member *device_group_member, uint16_t sequence) {
+#ifndef USE_DEVICE_GROUPS_STATS
+  (void) device_group;
+#endif  // USE_DEVICE_GROUPS_STATS
+  if ((int16_t) (sequence - device_group_member->acked_sequence) > 0)
+    device_group_member->acked_sequence = sequence;
+
+#ifdef USE_DEVICE_GROUPS_STATS
+  // If that was the last ack we were waiting for, the update has reached every member.
+  if (device_group->stats.update_pending) {
+    for (struct device_group_member *member = device_group->device_group_members; member; member = member->flink) {
+      if (member->acked_sequence != device_group->outgoing_sequence)
+        return;
+    }
+    RecordDeviceGroupConvergence(device_group);
+  }
+#endif  // USE_DEVICE_GROUPS_STATS
+}
+
+// Classify a received packet from its header and items: acks go first because they cancel
+// retransmits, then updates that switch relays, then everything else.
+uint8_t DeviceGroupPacketPriority(const struct multicast_packet &packet) {
+  const uint8_t *message_end_ptr = packet.payload + packet.length;
+  const uint8_t *message_ptr = packet.payload + strlen((const char *) packet.payload) + 1;
+  if (message_ptr + 4 > message_end_ptr)
+    return DGR_PRIORITY_OTHER;
+  uint16_t flags = message_ptr[2] | message_ptr[3] << 8;
+  if (flags == DGR_FLAG_ACK)
+    return DGR_PRIORITY_ACK;
+  if (flags & (DGR_FLAG_STATUS_REQUEST | DGR_FLAG_ANNOUNCEMENT))
+    return DGR_PRIORITY_OTHER;
+
+  message_ptr += 4;
+  while (message_ptr < message_end_ptr) {
+    uint8_t item = *message_ptr++;
+    if (item == DGR_ITEM_EOL)
+      break;
+    if (item == DGR_ITEM_POWER)
+      return DGR_PRIORITY_POWER;
+    if (item <= DGR_ITEM_MAX_8BIT)
+      message_ptr++;
+    else if (item <= DGR_ITEM_MAX_16BIT)
+      message_ptr += 2;
+    else if (item <= DGR_ITEM_MAX_32BIT)
+      message_ptr += 4;
+    else if (message_ptr < message_end_ptr)
+      message_ptr += 1 + *message_ptr;
+  }
+  return DGR_PRIORITY_OTHER;
+}
+
+// Queue a received packet at its priority. A sender's messages must be applied in order, since a
+// message older than the last one applied from that sender is dropped, so a packet never goes
+// ahead of a queued message from the same sender; only acks, which carry no changes, always can.
+void device_groups::QueueDeviceGroupPacket(std::vector<multicast_packet> &queue, struct multicast_packet &packet) {
+  packet.priority = DeviceGroupPacketPriority(packet);
+  if (packet.priority != DGR_PRIORITY_ACK) {
+    for (const struct multicast_packet &queued : queue) {
+      if (queued.priority > packet.priority && queued.remoteIP == packet.remoteIP)
+        packet.priority = queued.priority;
+    }
+  }
+  queue.push_back(packet);
+}
+
+// Returns true when there's a packet to read and budget left to read it. A packet found after the
+// budget ran out stays current in the socket until the next call, so a budget hit is only counted
+// when a packet is really left waiting.
+bool device_groups::DeviceGroupsNextPacket(uint32_t loop_start, uint32_t packets_read) {
+  if (!device_groups_udp_packet_waiting) {
+    if (!device_groups_udp.parsePacket())
+      return false;
+    device_groups_udp_packet_waiting = true;
+  }
+  if (!DeviceGroupsLoopBudgetLeft(loop_start, packets_read))
+    return false;
+  device_groups_udp_packet_waiting = false;
+  return true;
+}
+
+// Returns true if there's budget left for another packet. The first hit of a pass is counted.
+bool device_groups::DeviceGroupsLoopBudgetLeft(uint32_t loop_start, uint32_t packets) {
+  if (max_loop_packets_ && packets >= max_loop_packets_) {
+    if (!loop_budget_hit_)
+      loop_budget_packet_hits_++;
+    loop_budget_hit_ = true;
+    return false;
+  }
+  if (max_loop_time_ && DeviceGroupsMicros() - loop_start >= max_loop_time_) {
+    if (!loop_budget_hit_)
+      loop_budget_time_hits_++;
+    loop_budget_hit_ = true;
+    return false;
+  }
+  return true;
+}
+
+// Process the queued packets in priority order while there's budget left, and at least one each
+// pass so the queue always drains. The packets left over keep their place for the next pass.
+// Returns false if the budget ran out with packets left.
+bool device_groups::ProcessDeviceGroupPackets(std::vector<multicast_packet> &queue, uint32_t loop_start) {
+  uint32_t packets_processed = 0;
+  for (uint8_t priority = 0; priority < DGR_PRIORITY_COUNT; priority++) {
+    for (auto packet = queue.begin(); packet != queue.end();) {
+      if (packet->priority != priority) {
+        packet++;
+        continue;
+      }
+      if (packets_processed && !DeviceGroupsLoopBudgetLeft(loop_start, packets_processed))
+        return false;
+      ProcessGroupMessageResult status = ProcessDeviceGroupMessage(*packet);
+#if defined(ESP8266)
+      if (status == PROCESS_GROUP_MESSAGE_UNMATCHED) {
+        bool isRegistered = false;
+        if (!strncmp_P((char *) packet->payload, kDeviceGroupMessage, sizeof(DEVICE_GROUP_MESSAGE) - 1)) {
+          const char *packet_group_name = (char *) packet->payload + sizeof(DEVICE_GROUP_MESSAGE) - 1;
+          for (const char *registered_group_name : registered_group_names) {
+            if (!strcmp(packet_group_name, registered_group_name)) {
+              isRegistered = true;
+              break;
+            }
+          }
+        }
+        if (isRegistered) {
+          packet++;  // Another instance's group, leave it for that instance
+          continue;
+        }
+        ESP_LOGVV(TAG, "Removing unregistered packet identifier, %s", packet->payload);
+      }
+#else
+      (void) status;
+#endif
+      packets_processed++;
+      packet = queue.erase(packet);
+    }
+  }
+  return true;
+}
+
 void device_groups::DeviceGroupsLoop(void) {
   if (!device_groups_up || TasmotaGlobal.restart_flag)
     return;
 
+  // Bound the packet handling done in one call so a burst of traffic can't starve the other
+  // components. Packets left in the socket or in the queue are picked up on the next call.
+  // Packets the last call left queued are worked off before more are read, so the queue never
+  // holds more than one call's reads.
+  uint32_t loop_start = DeviceGroupsMicros();
+  uint32_t packets_read = 0;
+  loop_budget_hit_ = false;
 #if defined(ESP8266)
-  while (device_groups_udp.parsePacket()) {
+  while (!packets_left_ && DeviceGroupsNextPacket(loop_start, packets_read)) {
     struct multicast_packet packet;
     int length = device_groups_udp.read(packet.payload, sizeof(packet.payload) - 1);
+    packets_read++;
     if (length > 0) {
       packet.id = packetId++;
       packet.payload[length] = 0;
       packet.length = length;
       packet.remoteIP = device_groups_udp.remoteIP();
-      received_packets.push_back(packet);
+      DGR_TRACE(DGR_TRACE_RX, 0xff, 0, DeviceGroupTraceAddress(packet.remoteIP), length);
+#ifdef USE_DEVICE_GROUPS_CAPTURE
+      CaptureDeviceGroupPacket(packet);
+#endif  // USE_DEVICE_GROUPS_CAPTURE
+      QueueDeviceGroupPacket(received_packets, packet);
     }
   }
+#ifdef USE_DEVICE_GROUPS_STATS
+  if (received_packets.size() > received_packets_max_)
+    received_packets_max_ = received_packets.size();
+#endif  // USE_DEVICE_GROUPS_STATS
 
-  for (multicast_packet packet : received_packets) {
-    std::string identifier(std::string(kDeviceGroupMessage) + this->device_group_name_ + '\0');
-    if (!strncmp_P((char *) packet.payload, identifier.c_str(), identifier.length())) {
-      ProcessGroupMessageResult status = ProcessDeviceGroupMessage(packet);
-      if (status != PROCESS_GROUP_MESSAGE_UNMATCHED) {
-        received_packets.erase(std::remove_if(received_packets.begin(), received_packets.end(),
-                                              [&](multicast_packet const &mcp) { return mcp.id == packet.id; }),
-                               received_packets.end());
-      }
-    } else {
-      bool isRegistered = false;
-      for (std::string registered_group_name : registered_group_names) {
-        std::string identifier_registered(std::string(kDeviceGroupMessage) + registered_group_name + '\0');
-        if (!strncmp_P((char *) packet.payload, identifier_registered.c_str(), identifier_registered.length())) {
-          isRegistered = true;
-          break;
-        }
-      }
-      if (!isRegistered) {
-        ESP_LOGVV(TAG, "Removing unregistered packet identifier, %s", packet.payload);
-        received_packets.erase(std::remove_if(received_packets.begin(), received_packets.end(),
-                                              [&](multicast_packet const &mcp) { return mcp.id == packet.id; }),
-                               received_packets.end());
-      }
-    }
-  }
+  packets_left_ = !ProcessDeviceGroupPackets(received_packets, loop_start);
 #else
-  while (device_groups_udp.parsePacket()) {
+  while (!packets_left_ && DeviceGroupsNextPacket(loop_start, packets_read)) {
     struct multicast_packet packet;
     int length = device_groups_udp.read(packet.payload, sizeof(packet.payload) - 1);
+    packets_read++;
     if (length > 0) {
       packet.id = 0; // Not used.
       packet.payload[length] = 0;
       packet.length = length;
       packet.remoteIP = device_groups_udp.remoteIP();
+      DGR_TRACE(DGR_TRACE_RX, 0xff, 0, DeviceGroupTraceAddress(packet.remoteIP), length);
+#if defined(USE_DEVICE_GROUPS_CAPTURE) || defined(USE_DEVICE_GROUPS_SIM)
+      CaptureDeviceGroupPacket(packet);
+#endif
       if (!strncmp_P((char *)packet.payload, kDeviceGroupMessage, sizeof(DEVICE_GROUP_MESSAGE) - 1)) {
-        ProcessDeviceGroupMessage(packet);
+        QueueDeviceGroupPacket(ingress_, packet);
       }
     }
   }
-#endif
 
-  uint32_t now = millis();
+  packets_left_ = !ProcessDeviceGroupPackets(ingress_, loop_start);
+#endif
+#ifdef USE_DEVICE_GROUPS_STATS
+  if (packets_read > packets_per_loop_max_)
+    packets_per_loop_max_ = packets_read;
+#endif  // USE_DEVICE_GROUPS_STATS
+
+  uint32_t now = DeviceGroupsMillis();
+
+  if ((int32_t) (now - loop_budget_report_time_) >= 0) {
+    uint32_t hits = loop_budget_packet_hits_ + loop_budget_time_hits_;
+    if (hits != loop_budget_reported_hits_)
+      ESP_LOGD(TAG, "Loop budget hit %u times in the last minute", hits - loop_budget_reported_hits_);
+    loop_budget_reported_hits_ = hits;
+    loop_budget_report_time_ = now + DGR_LOOP_BUDGET_REPORT_INTERVAL;
+  }
 
-  // If it's time to check on things, iterate through the device groups.
+  // If it's time to check on things, iterate through the device groups. The loop budget only
+  // limits packet handling: acks, retransmits, member timeouts and status replies still go out on
+  // time under a flood.
   if ((int32_t) (now - next_check_time) >= 0) {
 #ifdef DEVICE_GROUPS_DEBUG
     ESP_LOGD(TAG, "Checking next_check_time=%u, now=%u", next_check_time, now);
@@ -1329,6 +2248,25 @@ void device_groups::DeviceGroupsLoop(void) {
     struct device_group *device_group = device_groups_;
     for (uint32_t device_group_index = 0; device_group_index < device_group_count;
          device_group_index++, device_group++) {
+      // Send the delayed acks that are due.
+      if (device_group->next_ack_send_time) {
+        if ((int32_t) (now - device_group->next_ack_send_time) >= 0)
+          SendDueDeviceGroupAcks(device_group, now);
+        if (device_group->next_ack_send_time && (int32_t) (next_check_time - device_group->next_ack_send_time) > 0)
+          next_check_time = device_group->next_ack_send_time;
+      }
+
+      // If the status request collection window has closed, answer all the requests with one full
+      // status multicast.
+      if (device_group->status_response_time) {
+        if ((int32_t) (now - device_group->status_response_time) >= 0) {
+          device_group->status_response_time = 0;
+          _SendDeviceGroupMessage(-device_group_index, DGR_MSGTYP_FULL_STATUS);
+        } else if ((int32_t) (next_check_time - device_group->status_response_time) > 0) {
+          next_check_time = device_group->status_response_time;
+        }
+      }
+
       // If we're still waiting for acks to the last update from this device group, ...
       if (device_group->next_ack_check_time) {
         // If it's time to check for acks, ...
@@ -1337,19 +2275,21 @@ void device_groups::DeviceGroupsLoop(void) {
           if (device_group->initial_status_requests_remaining) {
             if (--device_group->initial_status_requests_remaining) {
 #ifdef DEVICE_GROUPS_DEBUG
-              ESP_LOGD(TAG, "Sending initial status request for group %s", device_group->group_name);
+              ESP_LOGD(TAG, "Sending initial status request for group %s", DeviceGroupName(device_group));
 #endif  // DEVICE_GROUPS_DEBUG
               SendReceiveDeviceGroupMessage(device_group, nullptr, device_group->message, device_group->message_length,
                                             false);
               device_group->message[device_group->message_header_length + 2] =
                   DGR_FLAG_STATUS_REQUEST;  // The reset flag is on only for the first packet - turn it off now
-              next_check_time = device_group->next_ack_check_time = now + 200;
-              continue;
+              device_group->status_request_postponed = false;
+              device_group->next_ack_check_time =
+                  now + DGR_STATUS_REQUEST_INTERVAL + (DeviceGroupsRandom() % DGR_STATUS_REQUEST_JITTER);
             }
 
             // If we've sent the initial status request message the set number of times, send our
-            // status to all the members.
+            // status to all the members. The requests are done, so the status gets a check of its own.
             else {
+              device_group->next_ack_check_time = 0;
               _SendDeviceGroupMessage(-device_group_index, DGR_MSGTYP_FULL_STATUS);
             }
           }
@@ -1357,7 +2297,7 @@ void device_groups::DeviceGroupsLoop(void) {
           // If we're done initializing, iterate through the group memebers, ...
           else {
 #ifdef DEVICE_GROUPS_DEBUG
-            ESP_LOGD(TAG, "Checking for %s ack's", device_group->group_name);
+            ESP_LOGD(TAG, "Checking for %s ack's", DeviceGroupName(device_group));
 #endif  // DEVICE_GROUPS_DEBUG
             bool acked = true;
             struct device_group_member **flink = &device_group->device_group_members;
@@ -1369,9 +2309,19 @@ void device_groups::DeviceGroupsLoop(void) {
                 // they're offline and remove them from the group.
                 if ((int32_t) (now - device_group->member_timeout_time) >= 0) {
                   *flink = device_group_member->flink;
-                  free(device_group_member);
-                  ESP_LOGD(TAG, "%s Member %s removed", device_group->group_name,
+                  DGR_TRACE(DGR_TRACE_MEMBER_REMOVE, device_group_index, device_group_member->acked_sequence,
+                            DeviceGroupTraceAddress(device_group_member->ip_address), 0);
+                  ESP_LOGD(TAG, "%s Member %s removed", DeviceGroupName(device_group),
                            IPAddressToString(device_group_member->ip_address));
+                  free(device_group_member);
+                  continue;
+                }
+
+                // If the member acked an update that's still in flight and the ones after it went
+                // out too recently to be acked, give them time before resending.
+                if (DeviceGroupUpdatesInFlight(device_group, device_group_member->acked_sequence, now)) {
+                  acked = false;
+                  flink = &device_group_member->flink;
                   continue;
                 }
 
@@ -1379,6 +2329,10 @@ void device_groups::DeviceGroupsLoop(void) {
                 // otherwise, unicast the message directly to this member.
                 if (device_group->multicasts_remaining)
                   device_group_member = nullptr;
+                ResendDeviceGroupChain(device_group, device_group_member);
+                DGR_TRACE(DGR_TRACE_RETRANSMIT, device_group_index, device_group->outgoing_sequence,
+                          (device_group_member ? DeviceGroupTraceAddress(device_group_member->ip_address) : 0),
+                          (device_group_member ? device_group_member->unicast_count : 0));
                 SendReceiveDeviceGroupMessage(device_group, device_group_member, device_group->message,
                                               device_group->message_length, false);
                 acked = false;
@@ -1394,14 +2348,25 @@ void device_groups::DeviceGroupsLoop(void) {
             // If we've received an ack to the last message from all members, clear the ack check
             // time and zero-out the message length.
             if (acked) {
+#ifdef USE_DEVICE_GROUPS_STATS
+              if (device_group->stats.update_pending)
+                RecordDeviceGroupConvergence(device_group);
+#endif  // USE_DEVICE_GROUPS_STATS
+              // Let _SendDeviceGroupMessage know we're done with this update.
               device_group->next_ack_check_time = 0;
-              device_group->message_length = 0;  // Let _SendDeviceGroupMessage know we're done with this update
+              device_group->message_length = 0;
+              ClearDeviceGroupUpdate(&device_group->update);
+              free(device_group->chain);
+              device_group->chain = nullptr;
+              device_group->chain_length = 0;
             }
 
-            // If there are still members we haven't received an ack from, set the next ack check
-            // time. We start at DGR_ACK_WAIT_TIME ms and add 100ms each pass with a maximum
-            // interval of 2 seconds.
+            // If there are still members we haven't received an ack from, drop the items they all
+            // have, so the next update doesn't carry them again, and set the next ack check time. We
+            // start at DGR_ACK_WAIT_TIME ms and add 100ms each pass with a maximum interval of 2
+            // seconds.
             else {
+              PruneDeviceGroupUpdate(device_group);
               device_group->ack_check_interval += 100;
               if (device_group->ack_check_interval > 2000)
                 device_group->ack_check_interval = 2000;
@@ -1427,7 +2392,7 @@ void device_groups::DeviceGroupsLoop(void) {
           SendReceiveDeviceGroupMessage(
               device_group, nullptr, device_group->message,
               BeginDeviceGroupMessage(device_group, DGR_FLAG_ANNOUNCEMENT, true) - device_group->message, false);
-          device_group->next_announcement_time = now + DGR_ANNOUNCEMENT_INTERVAL + (random_uint32() % 10000);
+          device_group->next_announcement_time = now + DGR_ANNOUNCEMENT_INTERVAL + (DeviceGroupsRandom() % 10000);
         }
         if ((int32_t) (next_check_time - device_group->next_announcement_time) > 0)
           next_check_time = device_group->next_announcement_time;
@@ -1436,6 +2401,104 @@ void device_groups::DeviceGroupsLoop(void) {
   }
 }
 
+#ifdef USE_DEVICE_GROUPS_STATS
+void device_groups::RecordDeviceGroupConvergence(struct device_group *device_group) {
+  struct device_group_stats *stats = &device_group->stats;
+  uint32_t convergence_time = DeviceGroupsMillis() - stats->update_start_time;
+  uint32_t bucket = 0;
+  while (bucket < DGR_STATS_BUCKETS - 1 && convergence_time >= (10u << bucket))
+    bucket++;
+  stats->histogram[bucket]++;
+  stats->updates++;
+  stats->packets += stats->update_packets;
+  stats->bytes += stats->update_bytes;
+  stats->update_pending = false;
+#ifdef DEVICE_GROUPS_DEBUG
+  ESP_LOGD(TAG, "%s update reached all members in %u ms, %u packets, %u bytes", DeviceGroupName(device_group),
+           convergence_time, stats->update_packets, stats->update_bytes);
+#endif  // DEVICE_GROUPS_DEBUG
+  if (!(stats->updates % DGR_STATS_REPORT_INTERVAL))
+    LogDeviceGroupConvergence(device_group);
+}
+
+void device_groups::LogDeviceGroupConvergence(struct device_group *device_group) {
+  struct device_group_stats *stats = &device_group->stats;
+  if (!stats->updates)
+    return;
+
+  // Percentiles are reported as the upper bound of the bucket they fall in.
+  uint32_t p50 = 0, p99 = 0, count = 0;
+  for (uint32_t bucket = 0; bucket < DGR_STATS_BUCKETS; bucket++) {
+    count += stats->histogram[bucket];
+    if (!p50 && count * 100 >= stats->updates * 50)
+      p50 = 10u << bucket;
+    if (!p99 && count * 100 >= stats->updates * 99)
+      p99 = 10u << bucket;
+  }
+  ESP_LOGI(TAG, "%s convergence: %u updates, p50 < %u ms, p99 < %u ms, %u packets and %u bytes per update",
+           DeviceGroupName(device_group), stats->updates, p50, p99, stats->packets / stats->updates,
+           stats->bytes / stats->updates);
+}
+#endif  // USE_DEVICE_GROUPS_STATS
+
+#if defined(USE_DEVICE_GROUPS_CAPTURE) || defined(USE_DEVICE_GROUPS_SIM)
+// Record a packet as it comes off the socket, before anything has looked at it. In a simulation it
+// goes into the attached capture; on a device it's logged as hex for device_groups_Capture to load.
+void device_groups::CaptureDeviceGroupPacket(const struct multicast_packet &packet) {
+#if defined(USE_DEVICE_GROUPS_SIM)
+  if (capture_)
+    capture_->add(DeviceGroupsMillis(), packet.remoteIP, packet.payload, packet.length);
+#else
+  uint8_t record[DGR_CAPTURE_RECORD_HEADER_SIZE + DGR_MAX_MESSAGE_SIZE];
+  uint32_t now = DeviceGroupsMillis();
+  record[0] = now;
+  record[1] = now >> 8;
+  record[2] = now >> 16;
+  record[3] = now >> 24;
+  for (uint32_t i = 0; i < 4; i++)
+    record[4 + i] = packet.remoteIP[i];
+  record[8] = packet.length;
+  record[9] = packet.length >> 8;
+  memcpy(&record[DGR_CAPTURE_RECORD_HEADER_SIZE], packet.payload, packet.length);
+
+  uint32_t record_length = DGR_CAPTURE_RECORD_HEADER_SIZE + packet.length;
+  char hex[DGR_CAPTURE_LOG_CHUNK * 2 + 1];
+  for (uint32_t offset = 0; offset < record_length; offset += DGR_CAPTURE_LOG_CHUNK) {
+    uint32_t chunk_length = std::min<uint32_t>(record_length - offset, DGR_CAPTURE_LOG_CHUNK);
+    for (uint32_t i = 0; i < chunk_length; i++)
+      sprintf_P(&hex[i * 2], PSTR("%02x"), record[offset + i]);
+    ESP_LOGI(TAG, DGR_CAPTURE_LOG_PREFIX "%c%s", (offset ? '+' : ' '), hex);
+  }
+#endif  // USE_DEVICE_GROUPS_SIM
+}
+#endif  // USE_DEVICE_GROUPS_CAPTURE || USE_DEVICE_GROUPS_SIM
+
+#ifdef USE_DEVICE_GROUPS_TRACE
+void device_groups::dump_trace() {
+  static const char *const event_names[] = {"rx", "decode", "apply", "tx", "ack", "retransmit", "member+", "member-"};
+  uint32_t count = std::min<uint32_t>(trace_count_, DGR_TRACE_SIZE);
+  ESP_LOGI(TAG, "Trace: last %u of %u events", count, trace_count_);
+  for (uint32_t index = trace_count_ - count; index != trace_count_; index++) {
+    const struct device_group_trace_record *record = &trace_[index & (DGR_TRACE_SIZE - 1)];
+    ESP_LOGI(TAG, "%10u %-10s group=%d seq=%u %u.%u.%u.%u value=0x%08x", record->time, event_names[record->event],
+             (record->group == 0xff ? -1 : record->group), record->sequence, record->address >> 24,
+             (record->address >> 16) & 0xff, (record->address >> 8) & 0xff, record->address & 0xff, record->value);
+  }
+}
+#endif  // USE_DEVICE_GROUPS_TRACE
+
+#if defined(USE_DEVICE_GROUPS_SIM)
+void device_groups::replay_capture(const device_groups_Capture &capture, uint32_t speedup) {
+  if (capture.records.empty())
+    return;
+  uint32_t first_time = capture.records.front().time_ms;
+  for (const device_groups_capture_record &record : capture.records) {
+    uint32_t delay = (speedup ? (record.time_ms - first_time) / speedup : 0);
+    device_groups_udp.inject(record.source, record.payload.data(), record.payload.size(), delay);
+  }
+}
+#endif  // USE_DEVICE_GROUPS_SIM
+
 bool device_groups::XdrvCall(uint8_t Function) {
   bool result = true;
   return result;
@@ -1458,9 +2521,12 @@ void device_groups::ExecuteCommandPower(uint32_t device, uint32_t state, uint32_
     }
   }
 
+  if (TasmotaGlobal.power != old_power)
+    InvalidateDeviceGroupStatus();
+
   if (TasmotaGlobal.power != old_power && SRC_REMOTE != source && SRC_RETRY != source) {
     power_t dgr_power = TasmotaGlobal.power;
-    if (Settings->flag4.multiple_device_groups) {  // SetOption88 - Enable relays in separate device groups
+    if (Settings.flag4.multiple_device_groups) {  // SetOption88 - Enable relays in separate device groups
       dgr_power = (dgr_power >> (device - 1)) & 1;
     }
     SendDeviceGroupMessage(device, DGR_MSGTYP_UPDATE, DGR_ITEM_POWER, dgr_power);
@@ -1470,33 +2536,76 @@ void device_groups::ExecuteCommandPower(uint32_t device, uint32_t state, uint32_
     return;
   }
 
-  if (SRC_REMOTE == source) {
+  // Remote changes are applied once the whole message has been processed.
+  if (SRC_REMOTE == source)
+    this->remote_power_changes_ |= (TasmotaGlobal.power ^ old_power);
+}
+
+// Applies the changes a received message made: each switch is written once and each light gets one
+// call, so a message with power, channels and brightness doesn't step a light through three states.
+void device_groups::ApplyRemoteDeviceGroupChanges(struct device_group *device_group) {
+  power_t changes = this->remote_power_changes_;
+  this->remote_power_changes_ = 0;
+
 #ifdef USE_SWITCH
-    for (switch_::Switch *obj : this->switches_) {
-      if (TasmotaGlobal.power > 0) {
-        obj->turn_on();
-      } else {
-        obj->turn_off();
-      }
+  for (uint32_t device = 1; device <= this->switches_.size(); device++) {
+    if (!((changes >> (device - 1)) & 1))
+      continue;
+    switch_::Switch *obj = this->switches_[device - 1];
+    if ((TasmotaGlobal.power >> (device - 1)) & 1) {
+      obj->turn_on();
+    } else {
+      obj->turn_off();
     }
+  }
 #endif
 #ifdef USE_LIGHT
-    for (light::LightState *obj : this->lights_) {
-      auto call = TasmotaGlobal.power > 0 ? obj->turn_on() : obj->turn_off();
-      call.perform();
+  int32_t transition_length = get_light_transition_length(device_group);
+  for (struct device_group_light &light : this->light_descriptors_) {
+    if (changes & 1) {
+      light.call.set_state(TasmotaGlobal.power & 1);
+      light.call_pending = true;
+    }
+    if (!light.call_pending)
+      continue;
+    if (light.call_brightness >= 0) {
+      // In an RGB mode the brightness is the color's, otherwise it's the light's and the color is off.
+      light::ColorMode color_mode = light.call_color_mode;
+      if (color_mode == light::ColorMode::UNKNOWN)
+        color_mode = light.obj->remote_values.get_color_mode();
+      if (color_mode & light::ColorCapability::RGB) {
+        light.call.set_color_brightness_if_supported(DeviceGroupLightValue(light.call_brightness));
+      } else {
+        light.call.set_brightness_if_supported(DeviceGroupLightValue(light.call_brightness));
+        light.call.set_color_brightness_if_supported(0);
+      }
+    }
+    if (transition_length >= 0)
+      light.call.set_transition_length(transition_length);
+    light.call.perform();
+    light.call = light.obj->make_call();
+    light.call_pending = false;
+    light.call_brightness = -1;
+    light.call_color_mode = light::ColorMode::UNKNOWN;
+    light.transition_start_time = 0;  // It replaced any local transition, so that isn't timed
+
+    // Tag the state the message left the light in, so a later callback reporting that same state
+    // isn't multicast back to the group.
+    light.remote_power_state = light.obj->remote_values.is_on();
+    light.remote_brightness = DeviceGroupLightLevel(light.obj->remote_values.get_brightness());
+    get_light_channels(light, light.remote_light_channels);
+    light.remote_origin = true;
   }
 #endif
-  }
 }
 
 void device_groups::ExecuteCommand(const char *cmnd, uint32_t source) { return; }
 
 void device_groups::InitTasmotaCompatibility() {
-  Settings = (TSettings *) malloc(sizeof(TSettings));
-  Settings->device_group_share_in = receive_mask_;
-  Settings->device_group_share_out = send_mask_;
-  Settings->flag4.device_groups_enabled = 1;
-  Settings->flag4.multiple_device_groups = 0;
+  Settings.device_group_share_in = receive_mask_;
+  Settings.device_group_share_out = send_mask_;
+  Settings.flag4.device_groups_enabled = 1;
+  Settings.flag4.multiple_device_groups = this->multiple_device_groups_;
 }
 
 }  // namespace device_groups
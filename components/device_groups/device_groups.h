@@ -5,12 +5,17 @@
 #include <vector>
 #include "esphome/components/network/ip_address.h"
 
-#if defined(USE_ESP32)
+#if defined(USE_DEVICE_GROUPS_SIM)
+#include "device_groups_SimUdp.h"  // In-memory multicast fabric for host simulations
+#include "device_groups_Capture.h"  // Record and replay of received packets
+#include "esp_idf_compatibility.h"
+#elif defined(USE_ESP32)
 #include <esp_wifi.h>
 #if defined(USE_ESP_IDF)
 #include "device_groups_WiFiUdp.h"  // Use local device_groups_WiFiUdp.h for ESP-IDF
 #include "esp_idf_compatibility.h"
 #else
+#include <WiFi.h>
 #include <WiFiUdp.h>  // Use system WiFiUdp.h for Arduino framework
 #endif
 #elif USE_ESP8266
@@ -34,15 +39,42 @@ namespace device_groups {
 // #define DEVICE_GROUPS_DEBUG
 #define DGR_MULTICAST_REPEAT_COUNT 1              // Number of times to re-send each multicast
 #define DGR_ACK_WAIT_TIME 150                     // Initial ms to wait for ack's
+#define DGR_ACK_DELAY_MAX 100                     // Max ms max_ack_delay can hold an ack, well inside DGR_ACK_WAIT_TIME
+#define DGR_PIGGYBACK_ACKS_MAX 16                 // Max held acks carried by one update (6 bytes each)
+#define DGR_MAX_IN_FLIGHT 4                       // Updates per group whose acks are tracked while newer ones go out
+#define DGR_RECEIVE_WINDOW 32                     // Sequences behind a member's newest that are still accepted once
 #define DGR_MEMBER_TIMEOUT 45000                  // ms to wait for ack's before removing a member
 #define DGR_ANNOUNCEMENT_INTERVAL 60000           // ms between announcements
+#define DGR_MAX_MESSAGE_SIZE 511                  // Max bytes in a packet, larger updates are split into several
+#define DGR_STATUS_COALESCE_TIME 100              // ms to collect status requests before answering with one full status
+#define DGR_DISCOVERY_DELAY 2000                  // ms after the network comes up before the first status request
+#define DGR_DISCOVERY_JITTER 1000                 // Max random ms added to the first status request
+#define DGR_STATUS_REQUEST_COUNT 10               // Max number of status requests sent while (re)discovering members
+#define DGR_STATUS_REQUEST_INTERVAL 200           // ms between status requests
+#define DGR_STATUS_REQUEST_JITTER 200             // Max random ms added to each status request interval
+#define DGR_LIGHT_SPEED_STEP 500                  // ms of light transition per Tasmota Speed step
+#define DGR_LIGHT_SPEED_MAX 40                    // Highest Tasmota Speed value
 #define DEVICE_GROUP_MESSAGE "TASMOTA_DGR"
 #define DEVICE_GROUPS_ADDRESS 239, 255, 250, 250  // Device groups multicast address
 #define DEVICE_GROUPS_PORT 4447                   // Device groups multicast port
 #define USE_DEVICE_GROUPS_SEND                    // Add support for the DevGroupSend command (+0k6 code)
+// #define USE_DEVICE_GROUPS_STATS                // Measure how long updates take to reach all members (+76 bytes per group)
+#define DGR_STATS_BUCKETS 12                      // Convergence time histogram buckets, from < 10ms doubling up to >= 10s
+#define DGR_STATS_REPORT_INTERVAL 50              // Log the convergence summary every this many updates
+#define DGR_IP_AND_UDP_HEADER_SIZE 28             // Bytes each packet adds on the air
+// #define USE_DEVICE_GROUPS_CAPTURE              // Log every received packet for replay on a host (+0k5 code)
+#define DGR_CAPTURE_MAGIC "DGRCAP1"               // Capture file magic, including the terminating 0
+#define DGR_CAPTURE_RECORD_HEADER_SIZE 10         // Time, sender and length ahead of each captured payload
+#define DGR_CAPTURE_LOG_PREFIX "DGRCAP"           // Log lines carrying a captured packet in hex
+#define DGR_CAPTURE_LOG_CHUNK 96                  // Captured bytes per log line, so lines fit the log buffer
+// #define USE_DEVICE_GROUPS_TRACE                // Record hot path events in a RAM ring for dump_trace() (+4k RAM)
+#define DGR_TRACE_SIZE 256                        // Trace records kept, a power of 2 (16 bytes each)
+#define DGR_LOOP_MAX_PACKETS 8                    // Default packets read per loop() call, 0 for no limit
+#define DGR_LOOP_MAX_TIME 10000                   // Default us of work per loop() call, 0 for no limit
+#define DGR_LOOP_BUDGET_REPORT_INTERVAL 60000     // ms between warnings that the loop budget was hit
 #define D_CMND_DEVGROUPSTATUS "DevGroupStatus"
 
-const uint8_t MAX_DEV_GROUP_NAMES = 4;  // Max number of Device Group names
+const uint8_t MAX_DEV_GROUP_NAMES = 24;  // Max number of Device Group names (one per relay)
 const uint16_t TOPSZ = 151;             // Max number of characters in topic string
 const char kDeviceGroupMessage[] = DEVICE_GROUP_MESSAGE;
 
@@ -105,11 +137,30 @@ enum DevGroupItem {
   // Add new string items before this line
   DGR_ITEM_LAST_STRING,
   DGR_ITEM_MAX_STRING = 223,
-  DGR_ITEM_LIGHT_CHANNELS
+  DGR_ITEM_LIGHT_CHANNELS,
+  // Extensions of this component. Like DGR_ITEM_LIGHT_CHANNELS they're a length byte followed by that
+  // many bytes, and this relies on stock Tasmota reading every item above DGR_ITEM_MAX_32BIT that way
+  // and skipping ones it doesn't know, so they must stay length-prefixed and above 224. Tasmota then
+  // neither uses the acks nor the chain: it still gets a separate ack when the delay runs out, and it
+  // acks each part of a split update on its own.
+  DGR_ITEM_ACKS,  // Held acks riding on an update: the member's IPv4 address and 16-bit sequence for each
+  DGR_ITEM_CHAIN  // On the last message of a split update: the 16-bit sequence of its first message
 };
 
 enum DevGroupItemFlag { DGR_ITEM_FLAG_NO_SHARE = 1 };
 
+// Slots of the items held in a pending update. Items are serialized in slot order, so the power and
+// no status share items go out ahead of the light items.
+enum DevGroupItemSlot {
+  DGR_SLOT_FIRST_32BIT,
+  DGR_SLOT_LIGHT_CHANNELS = DGR_SLOT_FIRST_32BIT + DGR_ITEM_LAST_32BIT - DGR_ITEM_MAX_16BIT - 1,
+  DGR_SLOT_FIRST_8BIT,
+  DGR_SLOT_FIRST_16BIT = DGR_SLOT_FIRST_8BIT + DGR_ITEM_LAST_8BIT,
+  DGR_SLOT_FIRST_STRING = DGR_SLOT_FIRST_16BIT + DGR_ITEM_LAST_16BIT - DGR_ITEM_MAX_8BIT - 1,
+  DGR_SLOT_COUNT = DGR_SLOT_FIRST_STRING + DGR_ITEM_LAST_STRING - DGR_ITEM_MAX_32BIT - 1,
+  DGR_SLOT_NONE = 0xff
+};
+
 enum DevGroupShareItem {
   DGR_SHARE_POWER = 1,
   DGR_SHARE_LIGHT_BRI = 2,
@@ -179,6 +230,35 @@ enum LoggingLevels {
   LOG_LEVEL_ALL
 };
 
+enum DevGroupTraceEvent : uint8_t {
+  DGR_TRACE_RX,               // Packet read from the socket: value is the length
+  DGR_TRACE_DECODE,           // Message matched to a group: value is flags << 16 | length
+  DGR_TRACE_APPLY,            // Received changes applied: value is the relays changed
+  DGR_TRACE_TX,               // Message sent: value is flags << 16 | length
+  DGR_TRACE_ACK,              // Ack received: value is 1 if it rode on an update
+  DGR_TRACE_RETRANSMIT,       // Unacked update sent again: value is the member's resend count
+  DGR_TRACE_MEMBER_ADD,
+  DGR_TRACE_MEMBER_REMOVE
+};
+
+#ifdef USE_DEVICE_GROUPS_TRACE
+struct device_group_trace_record {
+  uint32_t time;      // micros()
+  uint8_t event;      // DevGroupTraceEvent
+  uint8_t group;      // Device group index, 0xff if not known yet
+  uint16_t sequence;
+  uint32_t address;   // Member's IPv4 address, 0 for a multicast
+  uint32_t value;     // Event specific
+};
+
+// Tracepoints compile to nothing unless USE_DEVICE_GROUPS_TRACE is defined, arguments included.
+#define DGR_TRACE(EVENT, GROUP, SEQUENCE, ADDRESS, VALUE) TraceDeviceGroupEvent(EVENT, GROUP, SEQUENCE, ADDRESS, VALUE)
+#else
+#define DGR_TRACE(EVENT, GROUP, SEQUENCE, ADDRESS, VALUE) do {} while (0)
+#endif  // USE_DEVICE_GROUPS_TRACE
+
+uint32_t DeviceGroupsMicros();
+
 enum ProcessGroupMessageResult {
   PROCESS_GROUP_MESSAGE_ERROR,
   PROCESS_GROUP_MESSAGE_SUCCESS,
@@ -188,16 +268,57 @@ enum ProcessGroupMessageResult {
 struct device_group_member {
   struct device_group_member *flink;
   IPAddress ip_address;
-  uint16_t received_sequence;
+  uint16_t received_sequence;     // Newest sequence received from this member
   uint16_t acked_sequence;
+  uint32_t received_window;       // Bit n set if received_sequence - n was received, 0 if nothing was yet
+  uint32_t received_chain_window; // Bit n set if that message was flagged more-to-come
   uint32_t unicast_count;
+  uint32_t ack_due_time;          // When the delayed ack to this member is sent, 0 if none is pending
+  uint16_t pending_ack_sequence;  // Newest sequence the delayed ack covers
+  bool piggyback_acks;            // Member has sent DGR_ITEM_ACKS, so it reads the ones we send
 };
 
+struct device_group_update {
+  uint32_t present;   // Bitmask of the item slots in this update
+  uint32_t no_share;  // Bitmask of the item slots flagged DGR_ITEM_FLAG_NO_SHARE
+  uint32_t changed;   // Bitmask of the item slots set since the update was last sent
+  uint32_t values_32bit[DGR_ITEM_LAST_32BIT - DGR_ITEM_MAX_16BIT - 1];
+  uint16_t values_16bit[DGR_ITEM_LAST_16BIT - DGR_ITEM_MAX_8BIT - 1];
+  uint8_t values_8bit[DGR_ITEM_LAST_8BIT];
+  uint8_t light_channels[6];
+  char *strings[DGR_ITEM_LAST_STRING - DGR_ITEM_MAX_32BIT - 1];
+};
+
+#ifdef USE_DEVICE_GROUPS_STATS
+// Convergence of a group: the time from the first send of an update until every member has acked
+// it, and the packets that took in both directions. An update sent before the last one converged
+// extends the last one's measurement.
+struct device_group_stats {
+  uint32_t update_start_time;             // When the update being measured was first sent
+  uint32_t update_packets;                // Packets sent and acks received for it so far
+  uint32_t update_bytes;                  // Bytes those packets put on the air
+  bool update_pending;                    // An update is waiting for acks
+  uint32_t updates;                       // Updates that reached every member
+  uint32_t packets;                       // Packets those updates took
+  uint32_t bytes;                         // Bytes those updates put on the air
+  uint32_t histogram[DGR_STATS_BUCKETS];  // Updates by convergence time, bucket n is < 10 << n ms
+};
+#endif  // USE_DEVICE_GROUPS_STATS
+
+// An update that went out, kept so a member that acked it can be told apart from one that missed it.
+struct device_group_in_flight {
+  uint16_t sequence;
+  uint32_t send_time;
+};
+
+// The fields checked on every loop pass come first so they share cache lines. The group name is not
+// stored separately; it's the tail of the "TASMOTA_DGR<name>" header at the start of the message.
 struct device_group {
-  uint32_t next_announcement_time;
   uint32_t next_ack_check_time;
+  uint32_t next_announcement_time;
   uint32_t member_timeout_time;
-  uint32_t no_status_share;
+  uint32_t status_response_time;
+  uint32_t next_ack_send_time;  // Earliest ack_due_time of the members, 0 if no ack is pending
   uint16_t outgoing_sequence;
   uint16_t last_full_status_sequence;
   uint16_t message_length;
@@ -205,9 +326,26 @@ struct device_group {
   uint8_t message_header_length;
   uint8_t initial_status_requests_remaining;
   uint8_t multicasts_remaining;
-  char group_name[TOPSZ];
-  uint8_t message[128];
+  bool status_cache_valid;
+  bool status_request_postponed;  // Our next status request was already held off for another member's
   struct device_group_member *device_group_members;
+  uint8_t *message;
+  uint16_t message_size;
+  uint8_t status_cache_length;
+  uint32_t no_status_share;
+  uint8_t *status_cache;
+  uint8_t *chain;                 // The more-to-come parts of the update, each a 16-bit length and the message
+  uint16_t chain_length;
+  struct device_group_update update;
+  uint16_t update_sequences[DGR_SLOT_COUNT];  // Sequence of the last message carrying each slot's value
+  struct device_group_in_flight in_flight[DGR_MAX_IN_FLIGHT];
+  uint8_t in_flight_index;                    // Where the next update sent is recorded in in_flight
+  int16_t light_fade;                         // Last DGR_ITEM_LIGHT_FADE sent or received, -1 before the first
+  int16_t light_speed;                        // Last DGR_ITEM_LIGHT_SPEED sent or received, -1 before the first
+  int16_t light_scheme;                       // Last DGR_ITEM_LIGHT_SCHEME sent or received, -1 before the first
+#ifdef USE_DEVICE_GROUPS_STATS
+  struct device_group_stats stats;
+#endif  // USE_DEVICE_GROUPS_STATS
 #ifdef USE_DEVICE_GROUPS_SEND
   uint8_t values_8bit[DGR_ITEM_LAST_8BIT];
   uint16_t values_16bit[DGR_ITEM_LAST_16BIT - DGR_ITEM_MAX_8BIT - 1];
@@ -215,14 +353,15 @@ struct device_group {
 #endif  // USE_DEVICE_GROUPS_SEND
 };
 
+inline const char *DeviceGroupName(const struct device_group *device_group) {
+  return (const char *) device_group->message + sizeof(DEVICE_GROUP_MESSAGE) - 1;
+}
+
 struct TasmotaGlobal_t {
   bool skip_light_fade = false;  // Temporarily skip light fading
-  uint8_t devices_present = 20;  // Max number of devices supported
-  power_t power;                 // Current copy of Settings->power
+  uint8_t devices_present = 1;   // Number of relays, one per switch
+  power_t power = 0;             // Current copy of Settings->power
   uint8_t restart_flag = 0;      // Tasmota restart flag
-  int32_t fade = -1;
-  int32_t speed = -1;
-  int32_t scheme = -1;
   bool processing_light_transition = false;
 };
 
@@ -248,43 +387,114 @@ typedef union {
 } SOBitfield4;
 
 typedef struct {
-  SOBitfield4 flag4;                // EF8
-  uint8_t device_group_tie[4];      // FB0
-  uint32_t device_group_share_in;   // FCC  Bitmask of device group items imported
-  uint32_t device_group_share_out;  // FD0  Bitmask of device group items exported
+  SOBitfield4 flag4;                              // EF8
+  uint8_t device_group_tie[MAX_DEV_GROUP_NAMES];  // FB0  Relay each device group follows
+  uint32_t device_group_share_in;                 // FCC  Bitmask of device group items imported
+  uint32_t device_group_share_out;                // FD0  Bitmask of device group items exported
 } TSettings;
 
+// Order in which queued packets are processed.
+enum DevGroupPacketPriority : uint8_t { DGR_PRIORITY_ACK, DGR_PRIORITY_POWER, DGR_PRIORITY_OTHER, DGR_PRIORITY_COUNT };
+
 struct multicast_packet {
   uint32_t id;
+  uint8_t priority;  // DevGroupPacketPriority
   int length;
-  uint8_t payload[512];
+  uint8_t payload[DGR_MAX_MESSAGE_SIZE + 1];
   IPAddress remoteIP;
 };
 
 #if defined(ESP8266)
 static WiFiUDP device_groups_udp;
+static bool device_groups_udp_packet_waiting = false;  // parsePacket() found a packet the loop budget left
 static std::vector<multicast_packet> received_packets{};
-static std::vector<std::string> registered_group_names{};
+static std::vector<const char *> registered_group_names{};
 static uint32_t packetId = 0;
 #endif
 
-#if defined(USE_LIGHT)
-class device_groups : public Component, public light::LightRemoteValuesListener {
-#else
-class device_groups : public Component {
+#ifdef USE_LIGHT
+// How a light's white channels map onto the cold and warm white channels of DGR_ITEM_LIGHT_CHANNELS.
+enum DevGroupLightWhite : uint8_t {
+  DGR_LIGHT_WHITE_NONE,
+  DGR_LIGHT_WHITE_SINGLE,
+  DGR_LIGHT_WHITE_CT,
+  DGR_LIGHT_WHITE_CWWW
+};
+
+class device_groups;
+struct device_group_light;
+
+// Passes one light's remote values updates and finished transitions to the component, along with
+// which light it was.
+class device_group_light_listener : public light::LightRemoteValuesListener,
+                                    public light::LightTargetStateReachedListener {
+ public:
+  void on_light_remote_values_update() override;
+  void on_light_target_state_reached() override;
+  device_groups *parent;
+  struct device_group_light *light;
+};
+
+// A light's color channels, looked up once at setup, and the state last sent for it.
+struct device_group_light {
+  light::LightState *obj;
+  bool rgb;
+  uint8_t white;                            // DevGroupLightWhite
+  light::ColorCapability white_capability;  // Color capability of the white channels
+  uint16_t min_mireds;
+  uint16_t mireds_range;                    // max_mireds - min_mireds
+  light::LightCall call{nullptr};           // Changes from the message being processed
+  bool call_pending;                        // call has changes to perform at the end of the message
+  int16_t call_brightness;                  // DGR_ITEM_LIGHT_BRI of the message, -1 if it has none
+  light::ColorMode call_color_mode;         // Color mode call sets, UNKNOWN if it doesn't set one
+  bool remote_origin;                       // The light is in the state a received message left it in
+  bool remote_power_state;                  // The state the message left the light in
+  uint8_t remote_brightness;
+  uint8_t remote_light_channels[6];
+  bool previous_power_state;                // The state last seen by the listener
+  uint8_t previous_brightness;
+  uint8_t previous_light_channels[6];
+  uint32_t transition_start_time;           // millis() when a local change started a transition, 0 if none runs
+  uint32_t transition_length;               // ms the light's last local transition took
+  device_group_light_listener listener;
+};
 #endif
+
+class device_groups : public Component {
  public:
-  void register_device_group_name(std::string group_name) { this->device_group_name_ = std::move(group_name); }
+  void register_device_group_name(const char *group_name) { this->device_group_names_.push_back(group_name); }
+  /// Put each relay in its own device group (SetOption88): group N follows relay N.
+  void set_multiple_device_groups(bool multiple_device_groups) {
+    this->multiple_device_groups_ = multiple_device_groups;
+  }
 #ifdef USE_SWITCH
   void register_switches(const std::vector<switch_::Switch *> &switches) { this->switches_ = switches; }
 #endif
 #ifdef USE_LIGHT
   void register_lights(const std::vector<light::LightState *> &lights) { this->lights_ = lights; }
-  // LightRemoteValuesListener interface
-  void on_light_remote_values_update() override;
+  void register_scheme(uint8_t scheme, const char *effect) { this->schemes_.push_back({scheme, effect}); }
+  void on_light_remote_values_update(struct device_group_light &light);
+  void on_light_target_state_reached(struct device_group_light &light);
+#endif
+#if defined(USE_DEVICE_GROUPS_SIM)
+  /// Record every received packet into capture, or stop recording with nullptr.
+  void set_capture(device_groups_Capture *capture) { this->capture_ = capture; }
+  /// Queue a capture's packets on this device's socket, speedup times faster than recorded (0 for all at once).
+  void replay_capture(const device_groups_Capture &capture, uint32_t speedup);
+#endif
+#ifdef USE_DEVICE_GROUPS_TRACE
+  /// Log the trace ring, oldest event first.
+  void dump_trace();
 #endif
   void register_send_mask(uint32_t send_mask) { this->send_mask_ = send_mask; }
   void register_receive_mask(uint32_t receive_mask) { this->receive_mask_ = receive_mask; }
+  /// Hold acks for a random time of up to max_ack_delay ms, 0 to ack at once.
+  void set_max_ack_delay(uint32_t max_ack_delay) { this->max_ack_delay_ = max_ack_delay; }
+  /// Bound the work of one loop() call: packets handled and microseconds spent, 0 for no limit.
+  void set_loop_budget(uint32_t max_packets, uint32_t max_time) {
+    this->max_loop_packets_ = max_packets;
+    this->max_loop_time_ = max_time;
+  }
   void setup() override;
   void dump_config() override;
   float get_setup_priority() const override { return setup_priority::AFTER_WIFI; }
@@ -299,7 +509,13 @@ class device_groups : public Component {
 #define SendDeviceGroupMessage(DEVICE_INDEX, REQUEST_TYPE, ...) \
   _SendDeviceGroupMessage(DEVICE_INDEX, REQUEST_TYPE, ##__VA_ARGS__, 0)
   ProcessGroupMessageResult ProcessDeviceGroupMessage(multicast_packet);
-  bool XdrvCall(uint8_t Function);
+  void BuildDeviceGroupStatus(struct device_group *device_group, uint8_t device_group_index);
+  void InvalidateDeviceGroupStatus();
+  void ApplyRemoteDeviceGroupChanges(struct device_group *device_group);
+  /// Called as Tasmota calls its drivers: with FUNC_DEVICE_GROUP_ITEM for each item applied from a
+  /// received message, which is in XdrvMailbox, then once with DGR_ITEM_EOL. The host tools override
+  /// it to see what a device received.
+  virtual bool XdrvCall(uint8_t Function);
   void ExecuteCommandPower(uint32_t device, uint32_t state, uint32_t source);
   void ExecuteCommand(const char *cmnd, uint32_t source);
   void InitTasmotaCompatibility();
@@ -308,8 +524,43 @@ class device_groups : public Component {
   void DeviceGroupsLoop();
   void DeviceGroupsStop();
   void DeviceGroupStatus(uint8_t device_group_index);
-
-  std::string device_group_name_;
+  bool DeviceGroupsNextPacket(uint32_t loop_start, uint32_t packets_read);
+  bool DeviceGroupsLoopBudgetLeft(uint32_t loop_start, uint32_t packets);
+  void ScheduleDeviceGroupAck(struct device_group *device_group, struct device_group_member *device_group_member,
+                              uint16_t sequence);
+  void SendDueDeviceGroupAcks(struct device_group *device_group, uint32_t now);
+  void ResendDeviceGroupChain(struct device_group *device_group, struct device_group_member *device_group_member);
+  uint8_t *AppendDeviceGroupAcks(struct device_group *device_group, uint8_t *message_ptr, const uint8_t *end_ptr);
+  void ProcessDeviceGroupAcks(struct device_group *device_group, struct device_group_member *device_group_member,
+                              const uint8_t *acks, uint8_t length);
+  void SetDeviceGroupMemberAcked(struct device_group *device_group, struct device_group_member *device_group_member,
+                                 uint16_t sequence);
+  void QueueDeviceGroupPacket(std::vector<multicast_packet> &queue, struct multicast_packet &packet);
+  bool ProcessDeviceGroupPackets(std::vector<multicast_packet> &queue, uint32_t loop_start);
+#if defined(USE_DEVICE_GROUPS_CAPTURE) || defined(USE_DEVICE_GROUPS_SIM)
+  void CaptureDeviceGroupPacket(const struct multicast_packet &packet);
+#endif
+#ifdef USE_DEVICE_GROUPS_TRACE
+  void TraceDeviceGroupEvent(DevGroupTraceEvent event, uint8_t group, uint16_t sequence, uint32_t address,
+                             uint32_t value) {
+    struct device_group_trace_record *record = &trace_[trace_count_++ & (DGR_TRACE_SIZE - 1)];
+    record->time = DeviceGroupsMicros();
+    record->event = event;
+    record->group = group;
+    record->sequence = sequence;
+    record->address = address;
+    record->value = value;
+  }
+#endif  // USE_DEVICE_GROUPS_TRACE
+#ifdef USE_DEVICE_GROUPS_STATS
+  void RecordDeviceGroupConvergence(struct device_group *device_group);
+  void LogDeviceGroupConvergence(struct device_group *device_group);
+#endif  // USE_DEVICE_GROUPS_STATS
+  bool DeviceGroupHasLights(uint8_t device_group_index);
+  struct device_group *LightDeviceGroup();
+
+  std::vector<const char *> device_group_names_{};
+  bool multiple_device_groups_{false};
   bool update_{true};
   uint32_t send_mask_{0xffffffff};
   uint32_t receive_mask_{0xffffffff};
@@ -319,24 +570,50 @@ class device_groups : public Component {
 #endif
 #ifdef USE_LIGHT
   std::vector<light::LightState *> lights_{};
+  std::vector<std::pair<uint8_t, const char *>> schemes_{};  // Tasmota scheme number and the effect it runs
 #endif
 
 
-#if defined(USE_ESP_IDF)
+#if defined(USE_DEVICE_GROUPS_SIM)
+  device_groups_SimUDP device_groups_udp;
+  device_groups_Capture *capture_ = nullptr;
+#elif defined(USE_ESP_IDF)
   device_groups_WiFiUDP device_groups_udp;
 #elif !defined(ESP8266)
   WiFiUDP device_groups_udp;
 #endif
+#if !defined(ESP8266)
+  bool device_groups_udp_packet_waiting = false;  // parsePacket() found a packet the loop budget left
+  std::vector<multicast_packet> ingress_{};  // Packets read and not yet processed, processed by priority
+#endif
 
   struct device_group *device_groups_;
   uint32_t next_check_time;
   bool device_groups_initialized = false;
   bool device_groups_up = false;
-  bool building_status_message = false;
   bool ignore_dgr_sends = false;
-  TSettings *Settings = nullptr;
+  power_t remote_power_changes_ = 0;  // Relays a received message changed, applied at its end
+  uint32_t max_ack_delay_ = 0;
+  IPAddress local_ip_;  // Our address, as members name us in DGR_ITEM_ACKS
+  uint32_t max_loop_packets_ = DGR_LOOP_MAX_PACKETS;
+  uint32_t max_loop_time_ = DGR_LOOP_MAX_TIME;
+  uint32_t loop_budget_packet_hits_ = 0;    // Passes that left a packet waiting at max_loop_packets_
+  uint32_t loop_budget_time_hits_ = 0;      // Passes that left a packet waiting at max_loop_time_
+  uint32_t loop_budget_reported_hits_ = 0;  // Hits already reported
+  uint32_t loop_budget_report_time_ = 0;
+  bool loop_budget_hit_ = false;           // This pass already counted a hit
+  bool packets_left_ = false;              // The last pass ran out of budget with packets queued
+#ifdef USE_DEVICE_GROUPS_TRACE
+  struct device_group_trace_record trace_[DGR_TRACE_SIZE];
+  uint32_t trace_count_ = 0;  // Events recorded, the next goes in trace_[trace_count_ % DGR_TRACE_SIZE]
+#endif  // USE_DEVICE_GROUPS_TRACE
+#ifdef USE_DEVICE_GROUPS_STATS
+  uint32_t packets_per_loop_max_ = 0;  // Most packets read from the socket in one loop pass
+  uint32_t received_packets_max_ = 0;  // ESP8266: most packets held in received_packets at once
+#endif  // USE_DEVICE_GROUPS_STATS
+  TSettings Settings{};
   TasmotaGlobal_t TasmotaGlobal;
-  XDRVMAILBOX XdrvMailbox;
+  static XDRVMAILBOX XdrvMailbox;  // Scratch space while processing a message, shared by all instances
   DevGroupState dgr_state = DGR_STATE_UNINTIALIZED;
   bool setup_complete = false;
 
@@ -344,18 +621,16 @@ class device_groups : public Component {
   bool first_device_group_is_local = true;
 
 #ifdef USE_LIGHT
-  void get_light_values(light::LightState *obj, bool &power_state, float &brightness, float &color_brightness, float &red, float &green, float &blue, float &cold_white, float &warm_white, esphome::light::ColorMode &color_mode);
-  void set_light_intial_values(light::LightState *obj);
-  bool previous_power_state = false;
-  float previous_brightness = 0.0f;
-  float previous_color_brightness = 0.0f;
-  float previous_red = 0.0f;
-  float previous_green = 0.0f;
-  float previous_blue = 0.0f;
-  float previous_warm_white = 0.0f;
-  float previous_cold_white = 0.0f;
-  float previous_color_temperature = 0.0f;
-  esphome::light::ColorMode previous_color_mode = esphome::light::ColorMode::UNKNOWN;
+  void init_light_descriptor(light::LightState *obj, struct device_group_light *light);
+  void get_light_channels(const struct device_group_light &light, uint8_t *light_channels);
+  light::ColorMode set_light_channels(const struct device_group_light &light, light::LightCall &call,
+                          const uint8_t *light_channels);
+  uint8_t get_light_scheme(light::LightState *obj);
+  std::string get_scheme_effect(light::LightState *obj, uint8_t scheme);
+  uint8_t get_light_speed(const struct device_group_light &light);
+  int32_t get_light_transition_length(const struct device_group *device_group);
+  void set_light_intial_values(struct device_group_light &light);
+  std::vector<struct device_group_light> light_descriptors_{};
 #endif
 };
 
@@ -0,0 +1,198 @@
+#if defined(USE_DEVICE_GROUPS_SIM)
+
+#include "device_groups_Capture.h"
+#include "device_groups.h"
+#include <stdio.h>
+#include <string.h>
+
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_LINKTYPE_RAW 101
+#define PCAP_LINKTYPE_LINUX_SLL 113
+#define PCAP_LINKTYPE_IPV4 228
+#define PCAP_LINKTYPE_LINUX_SLL2 276
+
+static uint16_t get16(const uint8_t* data) { return data[0] | data[1] << 8; }
+static uint32_t get32(const uint8_t* data) { return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24; }
+static uint16_t get16be(const uint8_t* data) { return data[0] << 8 | data[1]; }
+static uint32_t swap32(uint32_t value) { return __builtin_bswap32(value); }
+
+static bool read_file(const char* path, std::vector<uint8_t>& data) {
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+    uint8_t buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + length);
+    fclose(file);
+    return true;
+}
+
+void device_groups_Capture::add(uint32_t time_ms, const IPAddress& source, const uint8_t* payload, size_t length) {
+    device_groups_capture_record record;
+    record.time_ms = time_ms;
+    record.source = source;
+    record.payload.assign(payload, payload + length);
+    records.push_back(std::move(record));
+}
+
+void device_groups_Capture::encode(uint32_t time_ms, const IPAddress& source, const uint8_t* payload, size_t length,
+                                   std::vector<uint8_t>& out) {
+    const uint8_t header[DGR_CAPTURE_RECORD_HEADER_SIZE] = {
+        (uint8_t) time_ms, (uint8_t) (time_ms >> 8), (uint8_t) (time_ms >> 16), (uint8_t) (time_ms >> 24),
+        source[0], source[1], source[2], source[3],
+        (uint8_t) length, (uint8_t) (length >> 8)};
+    out.insert(out.end(), header, header + sizeof(header));
+    out.insert(out.end(), payload, payload + length);
+}
+
+// Append the records in data, a series of encoded records, stopping at a truncated one.
+bool device_groups_Capture::decode(const uint8_t* data, size_t size) {
+    while (size >= DGR_CAPTURE_RECORD_HEADER_SIZE) {
+        size_t length = get16(data + 8);
+        if (DGR_CAPTURE_RECORD_HEADER_SIZE + length > size)
+            return false;
+        add(get32(data), IPAddress(data[4], data[5], data[6], data[7]), data + DGR_CAPTURE_RECORD_HEADER_SIZE, length);
+        data += DGR_CAPTURE_RECORD_HEADER_SIZE + length;
+        size -= DGR_CAPTURE_RECORD_HEADER_SIZE + length;
+    }
+    return !size;
+}
+
+bool device_groups_Capture::loadPcap(const uint8_t* data, size_t size) {
+    // The magic tells the byte order and whether timestamps are in microseconds or nanoseconds.
+    uint32_t magic = get32(data);
+    bool swapped = (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1);
+    if (swapped)
+        magic = swap32(magic);
+    uint32_t fraction_per_ms = (magic == 0xa1b23c4d ? 1000000 : 1000);
+    uint32_t linktype = get32(data + 20);
+    if (swapped)
+        linktype = swap32(linktype);
+
+    size_t offset = 24;
+    while (offset + 16 <= size) {
+        uint32_t seconds = get32(data + offset);
+        uint32_t fraction = get32(data + offset + 4);
+        uint32_t captured_length = get32(data + offset + 8);
+        if (swapped) {
+            seconds = swap32(seconds);
+            fraction = swap32(fraction);
+            captured_length = swap32(captured_length);
+        }
+        offset += 16;
+        if (offset + captured_length > size)
+            return false;
+        const uint8_t* frame = data + offset;
+        const uint8_t* frame_end = frame + captured_length;
+        offset += captured_length;
+
+        // Find the IPv4 header.
+        const uint8_t* ip = nullptr;
+        uint16_t ethertype = 0x0800;
+        if (linktype == PCAP_LINKTYPE_ETHERNET && captured_length >= 14) {
+            ethertype = get16be(frame + 12);
+            ip = frame + 14;
+            while ((ethertype == 0x8100 || ethertype == 0x88a8) && ip + 4 <= frame_end) {
+                ethertype = get16be(ip + 2);
+                ip += 4;
+            }
+        } else if (linktype == PCAP_LINKTYPE_LINUX_SLL && captured_length >= 16) {
+            ethertype = get16be(frame + 14);
+            ip = frame + 16;
+        } else if (linktype == PCAP_LINKTYPE_LINUX_SLL2 && captured_length >= 20) {
+            ethertype = get16be(frame);
+            ip = frame + 20;
+        } else if (linktype == PCAP_LINKTYPE_RAW || linktype == PCAP_LINKTYPE_IPV4) {
+            ip = frame;
+        }
+        if (!ip || ethertype != 0x0800 || ip + 20 > frame_end || (ip[0] >> 4) != 4)
+            continue;
+
+        // Keep unfragmented UDP packets to the device groups port.
+        uint32_t ip_header_length = (ip[0] & 0x0f) * 4;
+        const uint8_t* udp = ip + ip_header_length;
+        if (ip[9] != 17 || (get16be(ip + 6) & 0x3fff) || udp + 8 > frame_end)
+            continue;
+        if (get16be(udp + 2) != DEVICE_GROUPS_PORT)
+            continue;
+        const uint8_t* payload = udp + 8;
+        uint16_t udp_length = get16be(udp + 4);
+        if (udp_length < 8 || udp_length > frame_end - udp)
+            continue;
+        size_t payload_length = udp_length - 8;
+
+        add(seconds * 1000 + fraction / fraction_per_ms, IPAddress(ip[12], ip[13], ip[14], ip[15]), payload,
+            payload_length);
+    }
+    return true;
+}
+
+// Device logs carry each record as hex: a line with the prefix and a space starts a record, and a
+// line with the prefix and a '+' continues it.
+bool device_groups_Capture::loadLog(const uint8_t* data, size_t size) {
+    const char* text = (const char*) data;
+    const char* text_end = text + size;
+    const size_t prefix_length = sizeof(DGR_CAPTURE_LOG_PREFIX) - 1;
+    std::vector<uint8_t> record;
+    std::vector<uint8_t> encoded;
+
+    while (text < text_end) {
+        const char* line_end = (const char*) memchr(text, '\n', text_end - text);
+        if (!line_end)
+            line_end = text_end;
+        const char* found = nullptr;
+        for (const char* ptr = text; ptr + prefix_length < line_end; ptr++) {
+            if (!memcmp(ptr, DGR_CAPTURE_LOG_PREFIX, prefix_length) && (ptr[prefix_length] == ' ' ||
+                ptr[prefix_length] == '+')) {
+                found = ptr;
+                break;
+            }
+        }
+        if (found) {
+            if (found[prefix_length] == ' ') {
+                encoded.insert(encoded.end(), record.begin(), record.end());
+                record.clear();
+            }
+            for (const char* ptr = found + prefix_length + 1; ptr + 1 < line_end; ptr += 2) {
+                unsigned int byte;
+                if (sscanf(ptr, "%2x", &byte) != 1)
+                    break;
+                record.push_back(byte);
+            }
+        }
+        text = line_end + 1;
+    }
+    encoded.insert(encoded.end(), record.begin(), record.end());
+    return decode(encoded.data(), encoded.size()) && !records.empty();
+}
+
+bool device_groups_Capture::load(const char* path) {
+    std::vector<uint8_t> data;
+    records.clear();
+    if (!read_file(path, data))
+        return false;
+
+    if (data.size() >= sizeof(DGR_CAPTURE_MAGIC) && !memcmp(data.data(), DGR_CAPTURE_MAGIC, sizeof(DGR_CAPTURE_MAGIC)))
+        return decode(data.data() + sizeof(DGR_CAPTURE_MAGIC), data.size() - sizeof(DGR_CAPTURE_MAGIC));
+    if (data.size() >= 24) {
+        uint32_t magic = get32(data.data());
+        if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1 || magic == 0xa1b23c4d || magic == 0x4d3cb2a1)
+            return loadPcap(data.data(), data.size());
+    }
+    return loadLog(data.data(), data.size());
+}
+
+bool device_groups_Capture::save(const char* path) const {
+    std::vector<uint8_t> data(DGR_CAPTURE_MAGIC, DGR_CAPTURE_MAGIC + sizeof(DGR_CAPTURE_MAGIC));
+    for (const device_groups_capture_record& record : records)
+        encode(record.time_ms, record.source, record.payload.data(), record.payload.size(), data);
+
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+    bool written = (fwrite(data.data(), 1, data.size(), file) == data.size());
+    return !fclose(file) && written;
+}
+
+#endif  // USE_DEVICE_GROUPS_SIM
@@ -0,0 +1,72 @@
+#if defined(USE_DEVICE_GROUPS_SIM)
+
+#pragma once
+
+#include "device_groups_SimUdp.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+struct device_groups_capture_record {
+    uint32_t time_ms;              // When the packet was received
+    IPAddress source;
+    std::vector<uint8_t> payload;
+};
+
+/**
+ * @brief device_groups_Capture class that holds received device group packets for replay
+ *
+ * A capture file is DGR_CAPTURE_MAGIC followed by records, each a 32-bit time in ms, the sender's
+ * IPv4 address, a 16-bit payload length and the payload. Numbers are little endian, like the DGR
+ * messages themselves.
+ *
+ * Captures can be loaded from three sources:
+ * - capture files written by save()
+ * - pcap files, such as those written by tcpdump -w on port 4447 (Ethernet, Linux cooked or raw IP)
+ * - device logs with USE_DEVICE_GROUPS_CAPTURE defined, which carry each record as hex lines
+ */
+class device_groups_Capture {
+public:
+    std::vector<device_groups_capture_record> records;
+
+    /**
+     * @brief Append a packet
+     * @param time_ms When the packet was received
+     * @param source The sender's address
+     * @param payload The UDP payload
+     * @param length Length of the payload
+     */
+    void add(uint32_t time_ms, const IPAddress& source, const uint8_t* payload, size_t length);
+
+    /**
+     * @brief Replace the records with those in a file, detecting its format
+     * @param path The capture, pcap or log file
+     * @return true if the file was read and in a known format
+     */
+    bool load(const char* path);
+
+    /**
+     * @brief Write the records as a capture file
+     * @param path The file to write
+     * @return true if the file was written
+     */
+    bool save(const char* path) const;
+
+    /**
+     * @brief Encode a record in the capture file format
+     * @param time_ms When the packet was received
+     * @param source The sender's address
+     * @param payload The UDP payload
+     * @param length Length of the payload
+     * @param out Where to append the encoded record
+     */
+    static void encode(uint32_t time_ms, const IPAddress& source, const uint8_t* payload, size_t length,
+                       std::vector<uint8_t>& out);
+
+private:
+    bool decode(const uint8_t* data, size_t size);
+    bool loadPcap(const uint8_t* data, size_t size);
+    bool loadLog(const uint8_t* data, size_t size);
+};
+
+#endif  // USE_DEVICE_GROUPS_SIM
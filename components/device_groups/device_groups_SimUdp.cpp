@@ -0,0 +1,169 @@
+#if defined(USE_DEVICE_GROUPS_SIM)
+
+#include "device_groups_SimUdp.h"
+#include <string.h>
+#include <algorithm>
+
+#define SIM_IP_AND_UDP_HEADER_SIZE 28  // Bytes each packet adds on the air
+
+static std::vector<device_groups_SimUDP*> sim_devices;
+static device_groups_sim_config sim_config;
+static device_groups_sim_stats sim_stats;
+static uint32_t sim_time = 0;
+static uint32_t sim_busy_us = 0;  // Loop time spent receiving packets, on top of sim_time
+static uint32_t sim_random_state = 1;
+static uint32_t sim_packet_order = 0;
+static uint32_t sim_device_count = 0;
+
+device_groups_SimUDP::device_groups_SimUDP() : port(0), subscribed(false), read_position(0) {
+    // Give each simulated device its own address in 10.0.0.0/16.
+    sim_device_count++;
+    local_ip = IPAddress(10, 0, sim_device_count >> 8, sim_device_count & 0xff);
+    current.deliver_time = current.order = 0;
+    sim_devices.push_back(this);
+}
+
+device_groups_SimUDP::~device_groups_SimUDP() {
+    sim_devices.erase(std::remove(sim_devices.begin(), sim_devices.end(), this), sim_devices.end());
+}
+
+bool device_groups_SimUDP::beginMulticast(const IPAddress& multicast_ip, uint16_t port) {
+    this->multicast_ip = multicast_ip;
+    this->port = port;
+    subscribed = true;
+    return true;
+}
+
+void device_groups_SimUDP::stop() {
+    subscribed = false;
+    inbox.clear();
+    flush();
+}
+
+bool device_groups_SimUDP::beginPacket(const IPAddress& ip, uint16_t port) {
+    destination_ip = ip;
+    send_buffer.clear();
+    return subscribed;
+}
+
+size_t device_groups_SimUDP::write(const uint8_t* buffer, size_t size) {
+    send_buffer.insert(send_buffer.end(), buffer, buffer + size);
+    return size;
+}
+
+bool device_groups_SimUDP::endPacket() {
+    if (!subscribed)
+        return false;
+    sim_stats.packets_sent++;
+    sim_stats.bytes_sent += send_buffer.size() + SIM_IP_AND_UDP_HEADER_SIZE;
+
+    // A multicast reaches every other subscribed device, a unicast only the device it's sent to.
+    for (device_groups_SimUDP* device : sim_devices) {
+        if (device == this || !device->subscribed || device->port != port)
+            continue;
+        if (destination_ip == device->multicast_ip || destination_ip == device->local_ip)
+            device->deliver(local_ip, send_buffer);
+    }
+    send_buffer.clear();
+    return true;
+}
+
+void device_groups_SimUDP::deliver(const IPAddress& source, const std::vector<uint8_t>& payload) {
+    if (random() % 100 < sim_config.loss_percent) {
+        sim_stats.packets_lost++;
+        return;
+    }
+
+    int copies = 1;
+    if (random() % 100 < sim_config.duplicate_percent) {
+        sim_stats.packets_duplicated++;
+        copies++;
+    }
+
+    while (copies--) {
+        packet arriving;
+        arriving.deliver_time = sim_time + sim_config.latency_ms;
+        if (sim_config.jitter_ms)
+            arriving.deliver_time += random() % (sim_config.jitter_ms + 1);
+        // A reordered packet is held back long enough for packets sent after it to overtake it.
+        if (random() % 100 < sim_config.reorder_percent)
+            arriving.deliver_time += sim_config.latency_ms + sim_config.jitter_ms + 1;
+        arriving.order = sim_packet_order++;
+        arriving.source = source;
+        arriving.payload = payload;
+        inbox.push_back(arriving);
+    }
+}
+
+void device_groups_SimUDP::inject(const IPAddress& source, const uint8_t* payload, size_t length, uint32_t delay_ms) {
+    packet arriving;
+    arriving.deliver_time = sim_time + delay_ms;
+    arriving.order = sim_packet_order++;
+    arriving.source = source;
+    arriving.payload.assign(payload, payload + length);
+    inbox.push_back(std::move(arriving));
+}
+
+int device_groups_SimUDP::parsePacket() {
+    // Find the earliest packet that has arrived.
+    auto next = inbox.end();
+    for (auto it = inbox.begin(); it != inbox.end(); ++it) {
+        if ((int32_t) (sim_time - it->deliver_time) < 0)
+            continue;
+        if (next == inbox.end() || (int32_t) (it->deliver_time - next->deliver_time) < 0 ||
+            (it->deliver_time == next->deliver_time && it->order < next->order))
+            next = it;
+    }
+    if (next == inbox.end())
+        return 0;
+
+    current = std::move(*next);
+    inbox.erase(next);
+    read_position = 0;
+    sim_stats.packets_delivered++;
+    sim_busy_us += sim_config.receive_time_us;
+    return current.payload.size();
+}
+
+int device_groups_SimUDP::read(uint8_t* buffer, size_t size) {
+    size_t length = std::min(size, current.payload.size() - read_position);
+    memcpy(buffer, current.payload.data() + read_position, length);
+    read_position += length;
+    return length;
+}
+
+void device_groups_SimUDP::flush() {
+    current.payload.clear();
+    read_position = 0;
+}
+
+IPAddress device_groups_SimUDP::remoteIP() { return current.source; }
+
+IPAddress device_groups_SimUDP::localIP() { return local_ip; }
+
+void device_groups_SimUDP::configure(const device_groups_sim_config& config) {
+    sim_config = config;
+    memset(&sim_stats, 0, sizeof(sim_stats));
+    sim_time = 0;
+    sim_busy_us = 0;
+    sim_random_state = config.seed ? config.seed : 1;
+    sim_packet_order = 0;
+}
+
+void device_groups_SimUDP::advanceTime(uint32_t ms) { sim_time += ms; }
+
+uint32_t device_groups_SimUDP::now() { return sim_time; }
+
+uint32_t device_groups_SimUDP::micros() { return sim_time * 1000 + sim_busy_us; }
+
+uint32_t device_groups_SimUDP::random() {
+    // xorshift32: fast, and the same sequence on every host for a given seed.
+    sim_random_state ^= sim_random_state << 13;
+    sim_random_state ^= sim_random_state >> 17;
+    sim_random_state ^= sim_random_state << 5;
+    return sim_random_state;
+}
+
+const device_groups_sim_stats& device_groups_SimUDP::getStats() { return sim_stats; }
+
+#endif  // USE_DEVICE_GROUPS_SIM
@@ -0,0 +1,154 @@
+#if defined(USE_DEVICE_GROUPS_SIM)
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class IPAddress {
+public:
+    uint8_t bytes[4];
+    IPAddress() : bytes{0,0,0,0} {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{a,b,c,d} {}
+    uint8_t& operator[](int i) { return bytes[i]; }
+    const uint8_t& operator[](int i) const { return bytes[i]; }
+    bool operator==(const IPAddress& other) const {
+        return bytes[0] == other.bytes[0] && bytes[1] == other.bytes[1] &&
+               bytes[2] == other.bytes[2] && bytes[3] == other.bytes[3];
+    }
+    bool operator!=(const IPAddress& other) const { return !(*this == other); }
+};
+
+/**
+ * @brief Network conditions of the simulated multicast fabric
+ *
+ * Every packet is delivered to each recipient independently, so one multicast can be lost for some
+ * members and duplicated or late for others.
+ */
+struct device_groups_sim_config {
+    uint32_t seed = 1;               // Seed of the fabric's random number generator
+    uint8_t loss_percent = 0;        // Chance that a packet is lost on the way to a recipient
+    uint8_t duplicate_percent = 0;   // Chance that a recipient gets a packet twice
+    uint8_t reorder_percent = 0;     // Chance that a packet is held back behind later ones
+    uint32_t latency_ms = 2;         // Delay of every packet
+    uint32_t jitter_ms = 0;          // Max random delay added to each packet
+    uint32_t receive_time_us = 0;    // Loop time taking each packet from the socket costs, for loop budgets
+};
+
+/**
+ * @brief Traffic counters of the simulated multicast fabric
+ */
+struct device_groups_sim_stats {
+    uint32_t packets_sent;        // Packets handed to the fabric, multicasts counted once
+    uint32_t packets_delivered;   // Packets read by a recipient
+    uint32_t packets_lost;        // Copies dropped on the way to a recipient
+    uint32_t packets_duplicated;  // Extra copies delivered to a recipient
+    uint32_t bytes_sent;          // Bytes put on the air, including IP and UDP headers
+};
+
+/**
+ * @brief device_groups_SimUDP class that stands in for WiFiUDP in host simulations
+ *
+ * Each instance is one simulated device with its own address on an in-memory multicast fabric
+ * shared by all instances in the process. Time on the fabric only moves when advanceTime() is
+ * called, and all randomness comes from one seeded generator, so a run with the same seed and the
+ * same calls always produces the same traffic.
+ */
+class device_groups_SimUDP {
+private:
+    struct packet {
+        uint32_t deliver_time;        // Virtual time the packet arrives
+        uint32_t order;               // Send order, breaks ties between packets due at the same time
+        IPAddress source;
+        std::vector<uint8_t> payload;
+    };
+
+    IPAddress local_ip;
+    IPAddress multicast_ip;
+    uint16_t port;
+    bool subscribed;
+    IPAddress destination_ip;
+    std::vector<uint8_t> send_buffer;
+    std::vector<packet> inbox;        // Packets on their way to this device
+    packet current;                   // The packet returned by the last parsePacket()
+    size_t read_position;
+
+    void deliver(const IPAddress& source, const std::vector<uint8_t>& payload);
+
+public:
+    device_groups_SimUDP();
+    device_groups_SimUDP(const device_groups_SimUDP&) = delete;
+    device_groups_SimUDP& operator=(const device_groups_SimUDP&) = delete;
+    ~device_groups_SimUDP();
+
+    /**
+     * @brief Join the multicast group on the fabric
+     * @param multicast_ip The multicast IP address
+     * @param port The port number to receive on
+     * @return true
+     */
+    bool beginMulticast(const IPAddress& multicast_ip, uint16_t port);
+
+    /**
+     * @brief Leave the fabric and drop any packets still on their way
+     */
+    void stop();
+
+    bool beginPacket(const IPAddress& ip, uint16_t port);
+    bool endPacket();
+    size_t write(const uint8_t* buffer, size_t size);
+
+    /**
+     * @brief Take the earliest packet that has arrived by the current virtual time
+     * @return Size of the packet, 0 if none has arrived
+     */
+    int parsePacket();
+    int read(uint8_t* buffer, size_t size);
+    void flush();
+    IPAddress remoteIP();
+    IPAddress localIP();
+
+    /**
+     * @brief Queue a packet for this device, bypassing the fabric's loss, duplication and delay
+     * @param source The sender's address
+     * @param payload The UDP payload
+     * @param length Length of the payload
+     * @param delay_ms How long from now the packet arrives
+     */
+    void inject(const IPAddress& source, const uint8_t* payload, size_t length, uint32_t delay_ms);
+
+    /**
+     * @brief Reset the fabric: clock, counters and random number generator
+     * @param config The network conditions to simulate from now on
+     */
+    static void configure(const device_groups_sim_config& config);
+
+    /**
+     * @brief Move the virtual clock forward
+     * @param ms Number of milliseconds to advance
+     */
+    static void advanceTime(uint32_t ms);
+
+    /**
+     * @brief Current virtual time in milliseconds, used in place of millis()
+     */
+    static uint32_t now();
+
+    /**
+     * @brief Current virtual time in microseconds, used in place of micros()
+     *
+     * Besides the clock, it counts receive_time_us for every packet taken from a socket, so loop
+     * time budgets run out under a flood.
+     */
+    static uint32_t micros();
+
+    /**
+     * @brief Next number from the fabric's seeded generator, used in place of random_uint32()
+     */
+    static uint32_t random();
+
+    static const device_groups_sim_stats& getStats();
+};
+
+#endif  // USE_DEVICE_GROUPS_SIM
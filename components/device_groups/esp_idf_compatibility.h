@@ -1,7 +1,7 @@
 #ifndef ESP_IDF_COMPATIBILITY_H
 #define ESP_IDF_COMPATIBILITY_H
 
-#if defined(USE_ESP_IDF)
+#if defined(USE_ESP_IDF) || defined(USE_DEVICE_GROUPS_SIM)
 
 // ESP-IDF compatibility for Arduino PROGMEM functions
 #define PSTR(str) (str)
@@ -15,6 +15,6 @@
 // ESP-IDF compatibility for strncmp_P (PROGMEM version of strncmp)
 #define strncmp_P strncmp
 
-#endif // USE_ESP_IDF
+#endif // USE_ESP_IDF || USE_DEVICE_GROUPS_SIM
 
 #endif // ESP_IDF_COMPATIBILITY_H
@@ -0,0 +1,113 @@
+/*
+  dgr_bench.cpp - Device groups convergence benchmark on the host simulation
+
+  For each group size and loss rate of the matrix, lets the members find each other, then has
+  random members change their relay one at a time. For each update it measures how long it takes to
+  be acked by every member, and the airtime of all the packets sent meanwhile, updates,
+  retransmissions and acks alike. The p50 and p99 of both are printed, one line per group size and
+  loss rate.
+
+  Everything runs on the simulation's virtual clock with one seeded generator, so a run with the
+  same seed always prints the same numbers.
+
+  Build: make -C tools dgr_bench
+  Usage: dgr_bench [-u UPDATES] [-S SEED]
+*/
+
+#include "dgr_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define BENCH_UPDATE_TIMEOUT 60000  // ms an update is given to reach every member
+#define BENCH_UPDATE_GAP 500        // ms between one update reaching every member and the next
+#define BENCH_AIR_RATE 1000000      // Bits per second on the air, the 802.11b basic rate multicasts use
+
+static const uint32_t bench_members[] = {10, 50, 200};
+static const uint8_t bench_loss_percents[] = {0, 5, 20};
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: dgr_bench [options]\n"
+          "  -u UPDATES  Updates measured per group size and loss rate (default 100)\n"
+          "  -S SEED     Random seed (default 1)\n");
+  exit(1);
+}
+
+// Nearest rank percentile of sorted values.
+static uint32_t percentile(const std::vector<uint32_t> &values, uint32_t percent) {
+  if (values.empty())
+    return 0;
+  size_t rank = (values.size() * percent + 99) / 100;
+  return values[rank ? rank - 1 : 0];
+}
+
+static void bench(uint32_t member_count, uint8_t loss_percent, uint32_t update_count, uint32_t seed) {
+  device_groups_sim_config config;
+  config.seed = seed;
+  config.loss_percent = loss_percent;
+  config.jitter_ms = 5;
+  device_groups_SimUDP::configure(config);
+
+  sim_devices devices;
+  sim_add_devices(devices, member_count);
+  sim_run(devices, SIM_SETTLE_TIME);
+
+  std::vector<uint32_t> times, airtimes;
+  uint32_t packets = 0, timeouts = 0;
+  for (uint32_t update = 0; update < update_count; update++) {
+    sim_device &sender = *devices[device_groups_SimUDP::random() % devices.size()];
+    uint32_t start_time = device_groups_SimUDP::now();
+    uint32_t start_packets = device_groups_SimUDP::getStats().packets_sent;
+    uint32_t start_bytes = device_groups_SimUDP::getStats().bytes_sent;
+    sender.toggle();
+    while (!sender.all_acked() && device_groups_SimUDP::now() - start_time < BENCH_UPDATE_TIMEOUT)
+      sim_step(devices);
+    if (!sender.all_acked())
+      timeouts++;
+
+    times.push_back(device_groups_SimUDP::now() - start_time);
+    airtimes.push_back((uint64_t) (device_groups_SimUDP::getStats().bytes_sent - start_bytes) * 8 * 1000 /
+                       BENCH_AIR_RATE);
+    packets += device_groups_SimUDP::getStats().packets_sent - start_packets;
+    sim_run(devices, BENCH_UPDATE_GAP);
+  }
+
+  std::sort(times.begin(), times.end());
+  std::sort(airtimes.begin(), airtimes.end());
+  printf("%8u %5u %7u %6u %6u %14u %14u %7.1f %8u\n", member_count, loss_percent, update_count,
+         percentile(times, 50), percentile(times, 99), percentile(airtimes, 50), percentile(airtimes, 99),
+         (double) packets / update_count, timeouts);
+  fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+  uint32_t update_count = 100;
+  uint32_t seed = 1;
+
+  int option;
+  while ((option = getopt(argc, argv, "u:S:")) != -1) {
+    switch (option) {
+      case 'u':
+        update_count = atoi(optarg);
+        break;
+      case 'S':
+        seed = strtoul(optarg, nullptr, 0);
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind < argc || !update_count)
+    usage();
+  sim_log_from_environment();
+
+  printf("%8s %5s %7s %6s %6s %14s %14s %7s %8s\n", "#members", "loss%", "updates", "p50_ms", "p99_ms",
+         "p50_airtime_ms", "p99_airtime_ms", "packets", "timeouts");
+  for (uint32_t member_count : bench_members) {
+    for (uint8_t loss_percent : bench_loss_percents)
+      bench(member_count, loss_percent, update_count, seed);
+  }
+  return 0;
+}
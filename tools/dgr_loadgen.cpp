@@ -0,0 +1,403 @@
+/*
+  dgr_loadgen.cpp - Tasmota device groups load generator for Linux
+
+  Multicasts well-formed device group traffic (updates, acks, announcements and status requests)
+  at a fixed or ramping packet rate, and counts the acks a device under test sends back to the
+  updates addressed to its groups. When the ack rate falls behind the update rate, the device's
+  loop has stopped keeping up.
+
+  Traffic for groups the device isn't in (-f) stands in for a neighbouring site sharing the VLAN:
+  the device still has to read and discard every one of those packets.
+
+  With -s, packets are sent from a range of made-up sender addresses through a raw socket (root or
+  CAP_NET_RAW required), so the device sees many members instead of one. The host's own address
+  stays one of the senders: acks to made-up senders never come back, so only its packets are
+  counted.
+
+  Build: g++ -O2 -o dgr_loadgen dgr_loadgen.cpp
+*/
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+// These mirror device_groups.h.
+#define DEVICE_GROUP_MESSAGE "TASMOTA_DGR"
+#define DEVICE_GROUPS_ADDRESS "239.255.250.250"
+#define DEVICE_GROUPS_PORT 4447
+#define DGR_MAX_MESSAGE_SIZE 511
+
+#define DGR_FLAG_STATUS_REQUEST 2
+#define DGR_FLAG_ACK 8
+#define DGR_FLAG_ANNOUNCEMENT 64
+
+#define DGR_ITEM_EOL 0
+#define DGR_ITEM_LIGHT_BRI 5
+#define DGR_ITEM_POWER 128
+#define DGR_ITEM_LIGHT_CHANNELS 224
+
+#define LOADGEN_PENDING_ACKS 4096  // Updates remembered per group for matching acks, a power of 2
+#define LOADGEN_MAX_RATE 1000000   // Packets per second, the most a microsecond send interval allows
+
+enum LoadgenMessageType { LOADGEN_UPDATE, LOADGEN_ACK, LOADGEN_ANNOUNCEMENT, LOADGEN_STATUS_REQUEST, LOADGEN_TYPES };
+
+struct loadgen_pending_ack {
+  uint16_t sequence;
+  uint64_t sent_time;
+};
+
+struct loadgen_group {
+  std::string name;
+  bool foreign;                               // Not a group of the device under test
+  std::vector<uint16_t> sequences;            // Next sequence of each sender
+  std::vector<loadgen_pending_ack> pending;   // Our updates awaiting acks, by sequence
+};
+
+static volatile bool stop_requested = false;
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: dgr_loadgen [options] GROUP...\n"
+          "  GROUP       Device group the device under test is in\n"
+          "  -r RATE     Packets per second, at most 1000000 (default 100)\n"
+          "  -R STEP     Add STEP packets per second after each report\n"
+          "  -d SECONDS  Stop after this long (default 10, 0 runs until interrupted)\n"
+          "  -f COUNT    Also send to COUNT groups the device isn't in (default 0)\n"
+          "  -m MIX      Relative weights of updates:acks:announcements:status requests (default 70:20:5:5)\n"
+          "  -s IP       Send from made-up addresses starting at IP (needs root)\n"
+          "  -c COUNT    Number of made-up senders with -s (default 1)\n"
+          "  -t IP       Send to this address instead of the device groups multicast address\n"
+          "  -i IP       Send multicasts from the interface with this address\n"
+          "  -x          Change power and brightness in every update instead of repeating them\n"
+          "  -S SEED     Random seed (default 1)\n");
+  exit(1);
+}
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t random_state = 1;
+static uint32_t loadgen_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+static void on_signal(int) { stop_requested = true; }
+
+static uint8_t *append_item(uint8_t *ptr, uint8_t item, uint32_t value) {
+  *ptr++ = item;
+  *ptr++ = value;
+  if (item > 63) {
+    *ptr++ = value >> 8;
+    if (item > 127) {
+      *ptr++ = value >> 16;
+      *ptr++ = value >> 24;
+    }
+  }
+  return ptr;
+}
+
+static int build_message(uint8_t *message, const loadgen_group &group, uint16_t sequence, LoadgenMessageType type,
+                         bool vary) {
+  uint8_t *ptr = message + sprintf((char *) message, DEVICE_GROUP_MESSAGE "%s", group.name.c_str()) + 1;
+  uint16_t flags = 0;
+  if (type == LOADGEN_ACK)
+    flags = DGR_FLAG_ACK;
+  else if (type == LOADGEN_ANNOUNCEMENT)
+    flags = DGR_FLAG_ANNOUNCEMENT;
+  else if (type == LOADGEN_STATUS_REQUEST)
+    flags = DGR_FLAG_STATUS_REQUEST;
+  *ptr++ = sequence;
+  *ptr++ = sequence >> 8;
+  *ptr++ = flags;
+  *ptr++ = flags >> 8;
+
+  if (type == LOADGEN_UPDATE) {
+    uint32_t random = (vary ? loadgen_random() : 0x80000001);
+    ptr = append_item(ptr, DGR_ITEM_POWER, (random & 1) | 1 << 24);
+    ptr = append_item(ptr, DGR_ITEM_LIGHT_BRI, random >> 24);
+    *ptr++ = DGR_ITEM_LIGHT_CHANNELS;
+    *ptr++ = 6;
+    for (int channel = 0; channel < 6; channel++)
+      *ptr++ = (vary ? loadgen_random() : 255);
+  }
+  if (type != LOADGEN_ACK)
+    *ptr++ = DGR_ITEM_EOL;
+  return ptr - message;
+}
+
+static uint16_t ip_checksum(const void *data, int length) {
+  const uint8_t *bytes = (const uint8_t *) data;
+  uint32_t sum = 0;
+  for (int i = 0; i + 1 < length; i += 2)
+    sum += bytes[i] << 8 | bytes[i + 1];
+  if (length & 1)
+    sum += bytes[length - 1] << 8;
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return htons(~sum);
+}
+
+// Wrap the message in IP and UDP headers from a made-up sender. The kernel routes the packet and
+// fills in the IP id, but the source address is left as given.
+static int send_spoofed(int raw_socket, in_addr source, const sockaddr_in &destination, const uint8_t *message,
+                        int message_length) {
+  uint8_t packet[sizeof(iphdr) + sizeof(udphdr) + DGR_MAX_MESSAGE_SIZE];
+  iphdr *ip = (iphdr *) packet;
+  udphdr *udp = (udphdr *) (packet + sizeof(iphdr));
+  int length = sizeof(iphdr) + sizeof(udphdr) + message_length;
+
+  memset(packet, 0, sizeof(iphdr) + sizeof(udphdr));
+  ip->version = 4;
+  ip->ihl = sizeof(iphdr) / 4;
+  ip->tot_len = htons(length);
+  ip->ttl = 1;
+  ip->protocol = IPPROTO_UDP;
+  ip->saddr = source.s_addr;
+  ip->daddr = destination.sin_addr.s_addr;
+  ip->check = ip_checksum(ip, sizeof(iphdr));
+  udp->source = htons(DEVICE_GROUPS_PORT);
+  udp->dest = htons(DEVICE_GROUPS_PORT);
+  udp->len = htons(sizeof(udphdr) + message_length);  // Checksum left at 0, which UDP over IPv4 allows
+  memcpy(packet + sizeof(iphdr) + sizeof(udphdr), message, message_length);
+
+  return sendto(raw_socket, packet, length, 0, (const sockaddr *) &destination, sizeof(destination));
+}
+
+int main(int argc, char **argv) {
+  double rate = 100;
+  double rate_step = 0;
+  uint32_t duration = 10;
+  uint32_t foreign_count = 0;
+  uint32_t weights[LOADGEN_TYPES] = {70, 20, 5, 5};
+  uint32_t sender_count = 1;
+  bool spoof = false;
+  bool vary = false;
+  in_addr spoof_base = {};
+  in_addr interface_address = {htonl(INADDR_ANY)};
+  const char *destination_address = DEVICE_GROUPS_ADDRESS;
+
+  int option;
+  while ((option = getopt(argc, argv, "r:R:d:f:m:s:c:t:i:xS:")) != -1) {
+    switch (option) {
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 'R':
+        rate_step = atof(optarg);
+        break;
+      case 'd':
+        duration = atoi(optarg);
+        break;
+      case 'f':
+        foreign_count = atoi(optarg);
+        break;
+      case 'm':
+        if (sscanf(optarg, "%u:%u:%u:%u", &weights[0], &weights[1], &weights[2], &weights[3]) != 4)
+          usage();
+        break;
+      case 's':
+        if (!inet_aton(optarg, &spoof_base))
+          usage();
+        spoof = true;
+        break;
+      case 'c':
+        sender_count = atoi(optarg);
+        break;
+      case 't':
+        destination_address = optarg;
+        break;
+      case 'i':
+        if (!inet_aton(optarg, &interface_address))
+          usage();
+        break;
+      case 'x':
+        vary = true;
+        break;
+      case 'S':
+        random_state = strtoul(optarg, nullptr, 0);
+        if (!random_state)
+          random_state = 1;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind >= argc || rate <= 0 || rate > LOADGEN_MAX_RATE || !sender_count)
+    usage();
+  // Sender 0 is the host itself, the rest are made up.
+  sender_count = (spoof ? sender_count + 1 : 1);
+  uint32_t total_weight = weights[0] + weights[1] + weights[2] + weights[3];
+  if (!total_weight)
+    usage();
+
+  std::vector<loadgen_group> groups;
+  for (int arg = optind; arg < argc; arg++)
+    groups.push_back({argv[arg], false, std::vector<uint16_t>(sender_count, 1),
+                      std::vector<loadgen_pending_ack>(LOADGEN_PENDING_ACKS)});
+  for (uint32_t foreign = 1; foreign <= foreign_count; foreign++)
+    groups.push_back({"loadgen_neighbour" + std::to_string(foreign), true, std::vector<uint16_t>(sender_count, 1)});
+
+  sockaddr_in destination = {};
+  destination.sin_family = AF_INET;
+  destination.sin_port = htons(DEVICE_GROUPS_PORT);
+  if (!inet_aton(destination_address, &destination.sin_addr))
+    usage();
+
+  // The UDP socket sends from the host's own address and receives the acks to those packets.
+  int udp_socket = socket(AF_INET, SOCK_DGRAM, 0);
+  int one = 1;
+  uint8_t ttl = 1;
+  sockaddr_in local = {};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(DEVICE_GROUPS_PORT);
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  setsockopt(udp_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  uint8_t loop = 0;  // Our own acks would otherwise come back and be counted as the device's
+  setsockopt(udp_socket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  setsockopt(udp_socket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+  setsockopt(udp_socket, IPPROTO_IP, IP_MULTICAST_IF, &interface_address, sizeof(interface_address));
+  if (bind(udp_socket, (sockaddr *) &local, sizeof(local)) < 0) {
+    perror("bind");
+    return 1;
+  }
+
+  int raw_socket = -1;
+  if (spoof) {
+    raw_socket = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+    if (raw_socket < 0) {
+      perror("raw socket");
+      return 1;
+    }
+    setsockopt(raw_socket, IPPROTO_IP, IP_MULTICAST_IF, &interface_address, sizeof(interface_address));
+  }
+
+  signal(SIGINT, on_signal);
+
+  uint8_t message[DGR_MAX_MESSAGE_SIZE + 1];
+  uint64_t sent[LOADGEN_TYPES] = {};
+  uint64_t expected_acks = 0, acks = 0, ack_time_total = 0, ack_time_max = 0, send_errors = 0;
+  uint64_t start_time = now_us();
+  uint64_t next_send_time = start_time;
+  uint64_t next_report_time = start_time + 1000000;
+
+  printf("# seconds rate sent updates expected_acks acks ack_percent ack_avg_ms ack_max_ms send_errors\n");
+  while (!stop_requested && (!duration || now_us() - start_time < (uint64_t) duration * 1000000)) {
+    uint64_t now = now_us();
+
+    // Send everything that's due, then wait for acks until the next packet is.
+    while ((int64_t) (now - next_send_time) >= 0) {
+      next_send_time += (uint64_t) (1000000 / rate);
+      loadgen_group &group = groups[loadgen_random() % groups.size()];
+      uint32_t sender = loadgen_random() % sender_count;
+      uint32_t pick = loadgen_random() % total_weight;
+      int type = 0;
+      while (pick >= weights[type])
+        pick -= weights[type++];
+
+      uint16_t sequence;
+      if (type == LOADGEN_ACK || type == LOADGEN_ANNOUNCEMENT)
+        sequence = group.sequences[sender] - 1;
+      else
+        sequence = group.sequences[sender]++;
+      int message_length = build_message(message, group, sequence, (LoadgenMessageType) type, vary);
+
+      int result;
+      if (sender) {
+        in_addr source = {htonl(ntohl(spoof_base.s_addr) + sender - 1)};
+        result = send_spoofed(raw_socket, source, destination, message, message_length);
+      } else {
+        result = sendto(udp_socket, message, message_length, 0, (sockaddr *) &destination, sizeof(destination));
+      }
+      if (result < 0) {
+        send_errors++;
+        continue;
+      }
+      sent[type]++;
+
+      // Only updates to the device's groups from our own address get acks we can see.
+      if (type == LOADGEN_UPDATE && !group.foreign && !sender) {
+        loadgen_pending_ack &slot = group.pending[sequence & (LOADGEN_PENDING_ACKS - 1)];
+        slot.sequence = sequence;
+        slot.sent_time = now;
+        expected_acks++;
+      }
+    }
+
+    int timeout = (int) ((next_send_time - now) / 1000);
+    pollfd poll_fd = {udp_socket, POLLIN, 0};
+    if (poll(&poll_fd, 1, timeout) > 0) {
+      sockaddr_in source;
+      socklen_t source_length = sizeof(source);
+      int length = recvfrom(udp_socket, message, DGR_MAX_MESSAGE_SIZE, MSG_DONTWAIT, (sockaddr *) &source,
+                            &source_length);
+      // Acks are the group name, sequence and the ack flag, with no items.
+      if (length > (int) sizeof(DEVICE_GROUP_MESSAGE) + 4 &&
+          !memcmp(message, DEVICE_GROUP_MESSAGE, sizeof(DEVICE_GROUP_MESSAGE) - 1)) {
+        message[length] = 0;
+        uint8_t *ptr = message + strlen((char *) message) + 1;
+        if (ptr + 4 <= message + length && ptr[2] == DGR_FLAG_ACK && !ptr[3]) {
+          uint16_t sequence = ptr[0] | ptr[1] << 8;
+          const char *name = (char *) message + sizeof(DEVICE_GROUP_MESSAGE) - 1;
+          loadgen_pending_ack *slot = nullptr;
+          for (loadgen_group &group : groups) {
+            if (!group.foreign && group.name == name) {
+              slot = &group.pending[sequence & (LOADGEN_PENDING_ACKS - 1)];
+              break;
+            }
+          }
+          if (slot && slot->sent_time && slot->sequence == sequence) {
+            uint64_t ack_time = now_us() - slot->sent_time;
+            ack_time_total += ack_time;
+            if (ack_time > ack_time_max)
+              ack_time_max = ack_time;
+            slot->sent_time = 0;
+            acks++;
+          }
+        }
+      }
+    }
+
+    now = now_us();
+    if ((int64_t) (now - next_report_time) >= 0) {
+      uint64_t total_sent = sent[0] + sent[1] + sent[2] + sent[3];
+      printf("%llu %.0f %llu %llu %llu %llu %.1f %.1f %.1f %llu\n",
+             (unsigned long long) ((now - start_time) / 1000000), rate, (unsigned long long) total_sent,
+             (unsigned long long) sent[LOADGEN_UPDATE], (unsigned long long) expected_acks,
+             (unsigned long long) acks, (expected_acks ? 100.0 * acks / expected_acks : 100.0),
+             (acks ? ack_time_total / 1000.0 / acks : 0.0), ack_time_max / 1000.0,
+             (unsigned long long) send_errors);
+      fflush(stdout);
+      memset(sent, 0, sizeof(sent));
+      expected_acks = acks = ack_time_total = ack_time_max = send_errors = 0;
+      next_report_time += 1000000;
+      rate += rate_step;
+      if (rate > LOADGEN_MAX_RATE)
+        rate = LOADGEN_MAX_RATE;
+      else if (rate < 1)
+        rate = 1;
+    }
+  }
+
+  close(udp_socket);
+  if (raw_socket >= 0)
+    close(raw_socket);
+  return 0;
+}
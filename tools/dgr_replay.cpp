@@ -0,0 +1,105 @@
+/*
+  dgr_replay.cpp - Replay captured device group traffic into a simulated device
+
+  Loads a capture, a pcap file or a device log with DGRCAP lines (see device_groups_Capture.h), and
+  replays its packets into one simulated device per group found in it. The packets go through the
+  same receive path as live ones, so the device decodes them, applies them to its relay and acks
+  them, as the device at the site did. At the end it prints what each device made of the traffic.
+
+  Set DGR_LOG=5 to follow the component's handling of each packet in its debug log.
+
+  Build: make -C tools dgr_replay
+  Usage: dgr_replay [-x SPEEDUP] [-o FILE] CAPTURE
+*/
+
+#include "dgr_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: dgr_replay [options] CAPTURE\n"
+          "  CAPTURE     Capture file, pcap file or device log\n"
+          "  -x SPEEDUP  Replay this many times faster than recorded, 0 for all at once (default 1)\n"
+          "  -o FILE     Also write the packets as a capture file\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  uint32_t speedup = 1;
+  const char *output_path = nullptr;
+
+  int option;
+  while ((option = getopt(argc, argv, "x:o:")) != -1) {
+    switch (option) {
+      case 'x':
+        speedup = atoi(optarg);
+        break;
+      case 'o':
+        output_path = optarg;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind + 1 != argc)
+    usage();
+  sim_log_from_environment();
+
+  device_groups_Capture capture;
+  if (!capture.load(argv[optind])) {
+    fprintf(stderr, "%s: not a capture, pcap file or log with captured packets\n", argv[optind]);
+    return 1;
+  }
+  if (output_path && !capture.save(output_path)) {
+    perror(output_path);
+    return 1;
+  }
+
+  // One device for each group the packets are for, and count the senders.
+  std::vector<std::string> group_names;
+  std::vector<IPAddress> senders;
+  for (const device_groups_capture_record &record : capture.records) {
+    const char *payload = (const char *) record.payload.data();
+    size_t length = record.payload.size();
+    if (length <= sizeof(DEVICE_GROUP_MESSAGE) || !memchr(payload, 0, length) ||
+        memcmp(payload, DEVICE_GROUP_MESSAGE, sizeof(DEVICE_GROUP_MESSAGE) - 1))
+      continue;
+    std::string group_name(payload + sizeof(DEVICE_GROUP_MESSAGE) - 1);
+    bool known = false;
+    for (const std::string &name : group_names)
+      known |= (name == group_name);
+    if (!known)
+      group_names.push_back(group_name);
+    known = false;
+    for (const IPAddress &sender : senders)
+      known |= (sender == record.source);
+    if (!known)
+      senders.push_back(record.source);
+  }
+  uint32_t span = (capture.records.empty() ? 0 : capture.records.back().time_ms - capture.records.front().time_ms);
+  printf("%u packets from %u senders for %u groups over %u ms\n", (uint32_t) capture.records.size(),
+         (uint32_t) senders.size(), (uint32_t) group_names.size(), span);
+
+  device_groups_SimUDP::configure(device_groups_sim_config());
+  sim_devices devices;
+  for (const std::string &name : group_names)
+    devices.emplace_back(new sim_device(name.c_str()));
+  sim_step(devices);  // Join the fabric before the first packet arrives
+
+  uint32_t sent = device_groups_SimUDP::getStats().packets_sent;
+  for (const std::unique_ptr<sim_device> &device : devices)
+    device->replay_capture(capture, speedup);
+  sim_run(devices, (speedup ? span / speedup : 0) + SIM_SETTLE_TIME);
+
+  for (uint32_t index = 0; index < devices.size(); index++) {
+    printf("%s: relay %s, %u members\n", group_names[index].c_str(), (devices[index]->relay.state ? "on" : "off"),
+           devices[index]->member_count());
+  }
+  printf("%u packets sent by the devices, acks and their own status requests\n",
+         device_groups_SimUDP::getStats().packets_sent - sent);
+  return 0;
+}
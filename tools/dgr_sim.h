@@ -0,0 +1,152 @@
+/*
+  dgr_sim.h - Simulated devices for the device groups host tools
+
+  A device is a device_groups instance with one relay in one group, SIM_GROUP unless another is
+  given, on the in-memory multicast fabric of device_groups_SimUdp. It can also have several relays,
+  in one group or each in its own. It's derived from the component so the tools can look at the
+  groups' member lists and the items the device receives.
+*/
+
+#pragma once
+
+#include "device_groups.h"
+#include "esphome/core/log.h"
+#include <stdlib.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dgr = esphome::device_groups;
+
+#define SIM_GROUP "simtest"
+#define SIM_SETTLE_TIME 10000  // ms for discovery to finish, with DGR_STATUS_REQUEST_COUNT requests to spare
+#define SIM_MAX_RELAYS 4       // Relays a device can have
+
+// An item applied from a received message: its value, or for a string item its text.
+struct sim_received_item {
+  uint8_t item;
+  int32_t value;
+  std::string text;
+};
+
+class sim_device : public dgr::device_groups {
+ public:
+  esphome::switch_::Switch relays[SIM_MAX_RELAYS];
+  esphome::switch_::Switch &relay = relays[0];
+  bool stopped = false;  // Off the network: its loop() isn't called
+  std::vector<sim_received_item> received_items;
+
+  explicit sim_device(const char *group_name = SIM_GROUP) : sim_device({group_name}, 1) {}
+
+  // A device with relay_count relays. With one group name they're all in that group; with one per
+  // relay, relay N is in group N, as with group_names.
+  sim_device(const std::vector<const char *> &group_names, uint32_t relay_count) {
+    for (const char *group_name : group_names)
+      this->register_device_group_name(group_name);
+    this->set_multiple_device_groups(group_names.size() > 1);
+    std::vector<esphome::switch_::Switch *> switches;
+    for (uint32_t index = 0; index < relay_count && index < SIM_MAX_RELAYS; index++)
+      switches.push_back(&this->relays[index]);
+    this->register_switches(switches);
+    this->setup();
+    this->dump_config();
+  }
+
+  uint32_t member_count(uint32_t device_group_index = 0) {
+    uint32_t count = 0;
+    if (device_group_index < this->device_group_count) {
+      for (dgr::device_group_member *member = this->device_groups_[device_group_index].device_group_members; member;
+           member = member->flink)
+        count++;
+    }
+    return count;
+  }
+
+  // Every member has acked our last update.
+  bool all_acked(uint32_t device_group_index = 0) {
+    if (device_group_index >= this->device_group_count)
+      return false;
+    const dgr::device_group &device_group = this->device_groups_[device_group_index];
+    for (dgr::device_group_member *member = device_group.device_group_members; member; member = member->flink) {
+      if (member->acked_sequence != device_group.outgoing_sequence)
+        return false;
+    }
+    return true;
+  }
+
+  uint32_t retransmissions() {
+    uint32_t count = 0;
+    if (this->device_group_count) {
+      for (dgr::device_group_member *member = this->device_groups_[0].device_group_members; member;
+           member = member->flink)
+        count += member->unicast_count;
+    }
+    return count;
+  }
+
+  // Packets read and not yet processed, and the loop passes that left packets waiting.
+  uint32_t queued_packets() { return this->ingress_.size(); }
+  uint32_t loop_budget_hits() { return this->loop_budget_packet_hits_ + this->loop_budget_time_hits_; }
+
+  // Put a packet on this device's socket, delay_ms from now, as if source had sent it.
+  void receive(const IPAddress &source, const std::vector<uint8_t> &payload, uint32_t delay_ms = 0) {
+    this->device_groups_udp.inject(source, payload.data(), payload.size(), delay_ms);
+  }
+
+  void toggle() {
+    if (this->relay.state)
+      this->relay.turn_off();
+    else
+      this->relay.turn_on();
+  }
+
+  // Send an update to the group of relay 1 with the given items and values, as a Tasmota rule's
+  // DevGroupSend would.
+  template<typename... Items> void send_update(Items... items) {
+    this->SendDeviceGroupMessage(1, dgr::DGR_MSGTYP_UPDATE, items...);
+  }
+
+  // Times a string item with this text was received.
+  uint32_t received_count(uint8_t item, const std::string &text) {
+    uint32_t count = 0;
+    for (const sim_received_item &received : this->received_items)
+      count += (received.item == item && received.text == text);
+    return count;
+  }
+
+  bool XdrvCall(uint8_t Function) override {
+    uint8_t item = XdrvMailbox.command_code;
+    if (Function == dgr::FUNC_DEVICE_GROUP_ITEM && item != dgr::DGR_ITEM_EOL) {
+      bool string = (item > dgr::DGR_ITEM_MAX_32BIT && item <= dgr::DGR_ITEM_MAX_STRING);
+      this->received_items.push_back({item, XdrvMailbox.payload, (string ? XdrvMailbox.data : "")});
+    }
+    return true;
+  }
+};
+
+typedef std::vector<std::unique_ptr<sim_device>> sim_devices;
+
+inline void sim_add_devices(sim_devices &devices, uint32_t count) {
+  while (count--)
+    devices.emplace_back(new sim_device());
+}
+
+// Run every device's loop once, then move the clock on a millisecond.
+inline void sim_step(const sim_devices &devices) {
+  for (const std::unique_ptr<sim_device> &device : devices) {
+    if (!device->stopped)
+      device->loop();
+  }
+  device_groups_SimUDP::advanceTime(1);
+}
+
+inline void sim_run(const sim_devices &devices, uint32_t ms) {
+  while (ms--)
+    sim_step(devices);
+}
+
+// DGR_LOG, if set, is the ESPHome log level number to show the component's log at (5 for debug).
+inline void sim_log_from_environment() {
+  if (getenv("DGR_LOG"))
+    esphome::host_log_level = atoi(getenv("DGR_LOG"));
+}
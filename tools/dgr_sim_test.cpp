@@ -0,0 +1,500 @@
+/*
+  dgr_sim_test.cpp - Device groups protocol tests on the host simulation
+
+  Runs several device_groups instances, mostly with one relay each in the same group, on the
+  in-memory multicast fabric, and checks that they find each other, that updates lost on the way
+  are retransmitted until every member has them, that a member which stops answering is dropped,
+  and that packets arriving out of order still leave every member in the sender's last state.
+  Devices with several relays, in one group or a group each, switch only the matching relays.
+  Received power updates are processed ahead of other packets, a device flooded past its loop
+  budget still runs its checks, held acks ride on updates, and items every member has drop out of
+  the updates that follow while changes keep coming. An update too large for one packet is split,
+  and every member gets all of it.
+  Captured traffic is saved and loaded back in each format, and replayed into a new device.
+
+  Build and run: make -C tools test
+  Set DGR_LOG to an ESPHome log level number (5 for debug) to see the component's log.
+*/
+
+#include "dgr_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+static int failures = 0;
+
+#define SIM_CHECK(condition)                                                   \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);    \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+static void start(const char *name, uint8_t loss_percent) {
+  printf("%s\n", name);
+  device_groups_sim_config config;
+  config.loss_percent = loss_percent;
+  config.jitter_ms = 5;
+  device_groups_SimUDP::configure(config);
+}
+
+// Devices that start together find each other, and one that joins later is found too and picks up
+// the group's current state from the full status it's sent.
+static void test_discovery() {
+  start("discovery", 0);
+  sim_devices devices;
+  sim_add_devices(devices, 3);
+  sim_run(devices, SIM_SETTLE_TIME);
+  for (const std::unique_ptr<sim_device> &device : devices)
+    SIM_CHECK(device->member_count() == 2);
+
+  devices[0]->relay.turn_on();
+  sim_run(devices, 1000);
+  sim_add_devices(devices, 1);
+  sim_run(devices, SIM_SETTLE_TIME);
+  for (const std::unique_ptr<sim_device> &device : devices) {
+    SIM_CHECK(device->member_count() == 3);
+    SIM_CHECK(device->relay.state);
+  }
+}
+
+// With a lossy network every update still reaches every member, by retransmission.
+static void test_retransmission() {
+  start("retransmission", 30);
+  sim_devices devices;
+  sim_add_devices(devices, 4);
+  sim_run(devices, SIM_SETTLE_TIME);
+
+  uint32_t lost = device_groups_SimUDP::getStats().packets_lost;
+  for (uint32_t update = 0; update < 10; update++) {
+    sim_device &sender = *devices[update % devices.size()];
+    sender.toggle();
+    bool state = sender.relay.state;
+    sim_run(devices, SIM_SETTLE_TIME);
+    SIM_CHECK(sender.member_count() == devices.size() - 1);
+    SIM_CHECK(sender.all_acked());
+    for (const std::unique_ptr<sim_device> &device : devices)
+      SIM_CHECK(device->relay.state == state);
+  }
+
+  uint32_t retransmissions = 0;
+  for (const std::unique_ptr<sim_device> &device : devices)
+    retransmissions += device->retransmissions();
+  SIM_CHECK(device_groups_SimUDP::getStats().packets_lost > lost);
+  SIM_CHECK(retransmissions > 0);
+}
+
+// A member that stops acking is dropped after DGR_MEMBER_TIMEOUT, and the rest carry on.
+static void test_member_timeout() {
+  start("member timeout", 0);
+  sim_devices devices;
+  sim_add_devices(devices, 3);
+  sim_run(devices, SIM_SETTLE_TIME);
+  SIM_CHECK(devices[0]->member_count() == 2);
+
+  devices[2]->stopped = true;
+  devices[0]->relay.turn_on();
+  sim_run(devices, DGR_MEMBER_TIMEOUT / 2);
+  SIM_CHECK(devices[0]->member_count() == 2);
+  SIM_CHECK(devices[1]->relay.state);
+  sim_run(devices, DGR_MEMBER_TIMEOUT);
+  SIM_CHECK(devices[0]->member_count() == 1);
+  SIM_CHECK(devices[0]->all_acked());
+
+  devices[1]->relay.turn_off();
+  sim_run(devices, 1000);
+  SIM_CHECK(!devices[0]->relay.state);
+}
+
+// Packets overtaking each other and arriving twice still leave every member with the sender's
+// last state. A late message is dropped rather than applied, since the newer one carried its changes.
+static void test_reordering() {
+  printf("reordering\n");
+  device_groups_sim_config config;
+  config.reorder_percent = 30;
+  config.duplicate_percent = 10;
+  config.jitter_ms = 5;
+  device_groups_SimUDP::configure(config);
+  sim_devices devices;
+  sim_add_devices(devices, 3);
+  sim_run(devices, SIM_SETTLE_TIME);
+
+  for (uint32_t round = 0; round < 10; round++) {
+    sim_device &sender = *devices[round % devices.size()];
+    for (uint32_t update = 0; update < 5 + round; update++) {
+      sender.toggle();
+      sim_run(devices, 1 + device_groups_SimUDP::random() % 4);  // Faster than the packets travel
+    }
+    sim_run(devices, SIM_SETTLE_TIME);
+    SIM_CHECK(sender.all_acked());
+    for (const std::unique_ptr<sim_device> &device : devices)
+      SIM_CHECK(device->relay.state == sender.relay.state);
+  }
+}
+
+// Each relay is its own bit of the power item, so a relay follows the same relay of the other
+// members without touching the rest, and a device with fewer relays only follows the ones it has.
+static void test_multiple_relays() {
+  start("multiple relays", 0);
+  sim_devices devices;
+  for (uint32_t count = 0; count < 2; count++)
+    devices.emplace_back(new sim_device({SIM_GROUP}, 3));
+  sim_run(devices, SIM_SETTLE_TIME);
+
+  devices[0]->relays[1].turn_on();
+  sim_run(devices, 1000);
+  SIM_CHECK(!devices[1]->relays[0].state && devices[1]->relays[1].state && !devices[1]->relays[2].state);
+  devices[1]->relays[1].turn_off();
+  devices[1]->relays[2].turn_on();
+  sim_run(devices, 1000);
+  SIM_CHECK(!devices[0]->relays[0].state && !devices[0]->relays[1].state && devices[0]->relays[2].state);
+
+  sim_add_devices(devices, 1);
+  sim_run(devices, SIM_SETTLE_TIME);
+  devices[2]->relay.turn_on();
+  sim_run(devices, 1000);
+  for (uint32_t index = 0; index < 2; index++) {
+    SIM_CHECK(devices[index]->relays[0].state && !devices[index]->relays[1].state);
+    SIM_CHECK(devices[index]->relays[2].state);
+  }
+}
+
+// With a group per relay, each relay only follows its own group, and members of one group don't
+// hear about the other.
+static void test_group_names() {
+  start("group names", 0);
+  sim_devices devices;
+  for (uint32_t count = 0; count < 2; count++)
+    devices.emplace_back(new sim_device({"simtest1", "simtest2"}, 2));
+  devices.emplace_back(new sim_device("simtest2"));
+  sim_run(devices, SIM_SETTLE_TIME);
+  SIM_CHECK(devices[0]->member_count(0) == 1);
+  SIM_CHECK(devices[0]->member_count(1) == 2);
+  SIM_CHECK(devices[2]->member_count() == 2);
+
+  devices[0]->relays[1].turn_on();
+  sim_run(devices, 1000);
+  SIM_CHECK(!devices[1]->relays[0].state && devices[1]->relays[1].state);
+  SIM_CHECK(devices[2]->relay.state);
+
+  devices[2]->relay.turn_off();
+  devices[1]->relays[0].turn_on();
+  sim_run(devices, 1000);
+  SIM_CHECK(devices[0]->relays[0].state && !devices[0]->relays[1].state);
+  SIM_CHECK(!devices[2]->relay.state);
+  SIM_CHECK(devices[0]->all_acked(0) && devices[0]->all_acked(1));
+}
+
+// A device group message as a member would send it: the items follow the header, sequence and
+// flags, and the EOL is added.
+static std::vector<uint8_t> group_message(const char *group_name, uint16_t sequence, uint16_t flags,
+                                          const std::vector<uint8_t> &items) {
+  std::string name = std::string(DEVICE_GROUP_MESSAGE) + group_name;
+  std::vector<uint8_t> message(name.c_str(), name.c_str() + name.size() + 1);
+  const uint8_t header[4] = {(uint8_t) sequence, (uint8_t) (sequence >> 8), (uint8_t) flags, (uint8_t) (flags >> 8)};
+  message.insert(message.end(), header, header + sizeof(header));
+  message.insert(message.end(), items.begin(), items.end());
+  message.push_back(dgr::DGR_ITEM_EOL);
+  return message;
+}
+
+// Of the packets read in one loop pass, an update that switches relays is processed ahead of
+// the others, even those that arrived before it.
+static void test_priority() {
+  printf("priority\n");
+  device_groups_sim_config config;
+  device_groups_SimUDP::configure(config);
+  sim_devices devices;
+  sim_add_devices(devices, 2);
+  sim_run(devices, SIM_SETTLE_TIME);
+
+  // Events from other members land on the socket just ahead of the power update.
+  devices[0]->received_items.clear();
+  const std::vector<uint8_t> event = {dgr::DGR_ITEM_EVENT, 2, 'x', 0};
+  for (uint8_t sender = 1; sender <= 5; sender++)
+    devices[0]->receive(IPAddress(10, 0, 9, sender), group_message(SIM_GROUP, 1, 0, event), config.latency_ms);
+  devices[1]->relay.turn_on();
+  sim_run(devices, 1000);
+
+  SIM_CHECK(devices[0]->relay.state);
+  SIM_CHECK(devices[0]->received_count(dgr::DGR_ITEM_EVENT, "x") == 5);
+  SIM_CHECK(!devices[0]->received_items.empty() && devices[0]->received_items[0].item == dgr::DGR_ITEM_POWER);
+}
+
+// A device flooded with more packets than its loop budget lets it read still runs its checks: it
+// resends its update while the acks are stuck behind the flood. Its queue stays short, and once
+// the flood is over it's worked off and the acks are found.
+static void test_loop_budget() {
+  printf("loop budget\n");
+  device_groups_sim_config config;
+  config.jitter_ms = 5;
+  config.receive_time_us = 400;
+  device_groups_SimUDP::configure(config);
+  sim_devices devices;
+  sim_add_devices(devices, 3);
+  sim_run(devices, SIM_SETTLE_TIME);
+
+  // A burst of packets for a group it isn't in, that takes two seconds to read with time for one a
+  // pass.
+  sim_device &flooded = *devices[0];
+  flooded.set_loop_budget(0, 300);
+  const std::vector<uint8_t> flood = group_message("flood", 1, dgr::DGR_FLAG_ANNOUNCEMENT, {});
+  for (uint32_t count = 0; count < 2000; count++)
+    flooded.receive(IPAddress(10, 0, 9, 1), flood);
+
+  flooded.toggle();
+  sim_run(devices, 1000);
+  SIM_CHECK(devices[1]->relay.state == flooded.relay.state && devices[2]->relay.state == flooded.relay.state);
+  SIM_CHECK(!flooded.all_acked());
+  SIM_CHECK(flooded.retransmissions() > 0);
+  SIM_CHECK(flooded.queued_packets() <= 1);
+  SIM_CHECK(flooded.loop_budget_hits() > 0);
+
+  sim_run(devices, 5000);
+  SIM_CHECK(flooded.all_acked());
+  SIM_CHECK(flooded.queued_packets() == 0);
+}
+
+// With max_ack_delay, acks held when a device sends its own update ride on it, so members that
+// change one after another send fewer packets, and every update still reaches every member.
+static void test_ack_delay() {
+  printf("ack delay\n");
+  uint32_t packets[2];
+  for (uint32_t max_ack_delay : {0, 100}) {
+    device_groups_sim_config config;
+    config.jitter_ms = 5;
+    device_groups_SimUDP::configure(config);
+    sim_devices devices;
+    sim_add_devices(devices, 4);
+    for (const std::unique_ptr<sim_device> &device : devices)
+      device->set_max_ack_delay(max_ack_delay);
+    sim_run(devices, SIM_SETTLE_TIME);
+
+    uint32_t start_packets = device_groups_SimUDP::getStats().packets_sent;
+    for (uint32_t round = 0; round < 5; round++) {
+      for (const std::unique_ptr<sim_device> &device : devices) {
+        device->toggle();
+        sim_run(devices, 10);
+      }
+      sim_run(devices, 1000);
+      for (const std::unique_ptr<sim_device> &device : devices) {
+        SIM_CHECK(device->all_acked());
+        SIM_CHECK(device->relay.state == devices.back()->relay.state);
+      }
+    }
+    packets[max_ack_delay ? 1 : 0] = device_groups_SimUDP::getStats().packets_sent - start_packets;
+  }
+  SIM_CHECK(packets[1] < packets[0]);
+}
+
+// While a device keeps changing faster than its updates are acked, members that acked one of the
+// updates in flight aren't resent anything, and an item every member has acked drops out of the
+// later updates instead of being applied again with each one.
+static void test_in_flight() {
+  printf("in flight\n");
+  device_groups_sim_config config;
+  config.latency_ms = 40;
+  device_groups_SimUDP::configure(config);
+  sim_devices devices;
+  sim_add_devices(devices, 3);
+  sim_run(devices, SIM_SETTLE_TIME);
+
+  devices[0]->send_update(dgr::DGR_ITEM_EVENT, "x");
+  for (uint32_t update = 0; update < 30; update++) {
+    sim_run(devices, 30);
+    devices[0]->toggle();
+  }
+  sim_run(devices, SIM_SETTLE_TIME);
+  SIM_CHECK(devices[0]->all_acked());
+  SIM_CHECK(devices[0]->retransmissions() == 0);
+  for (uint32_t index = 1; index < devices.size(); index++) {
+    SIM_CHECK(devices[index]->relay.state == devices[0]->relay.state);
+    SIM_CHECK(devices[index]->received_count(dgr::DGR_ITEM_EVENT, "x") <= DGR_ACK_WAIT_TIME / 30 + 1);
+  }
+}
+
+// Whether a captured packet is a more-to-come part of a split update.
+static bool more_to_come(const device_groups_capture_record &record) {
+  size_t header_length = strnlen((const char *) record.payload.data(), record.payload.size()) + 1;
+  return (header_length + 4 <= record.payload.size() &&
+          (record.payload[header_length + 2] & dgr::DGR_FLAG_MORE_TO_COME));
+}
+
+// An update too large for one packet goes out as a chain of messages, and every member applies all
+// of it once, also when parts are lost on the way and have to be resent.
+static void test_split(uint8_t loss_percent) {
+  start(loss_percent ? "split, lossy" : "split", loss_percent);
+  sim_devices devices;
+  sim_add_devices(devices, 3);
+  sim_run(devices, SIM_SETTLE_TIME);
+  device_groups_Capture captured;
+  devices[1]->set_capture(&captured);
+
+  for (uint32_t update = 0; update < 5; update++) {
+    // Two strings that only fit in DGR_MAX_MESSAGE_SIZE bytes one at a time.
+    std::string event(254, 'a' + update), command(254, 'A' + update);
+    devices[0]->send_update(dgr::DGR_ITEM_EVENT, event.c_str(), dgr::DGR_ITEM_COMMAND, command.c_str());
+    sim_run(devices, SIM_SETTLE_TIME);
+    SIM_CHECK(devices[0]->all_acked());
+    for (uint32_t index = 1; index < devices.size(); index++) {
+      SIM_CHECK(devices[index]->received_count(dgr::DGR_ITEM_EVENT, event) == 1);
+      SIM_CHECK(devices[index]->received_count(dgr::DGR_ITEM_COMMAND, command) == 1);
+    }
+  }
+
+  devices[1]->set_capture(nullptr);
+  bool split = false;
+  for (const device_groups_capture_record &record : captured.records)
+    split |= more_to_come(record);
+  SIM_CHECK(split);
+}
+
+static bool same_records(const device_groups_Capture &a, const device_groups_Capture &b) {
+  if (a.records.size() != b.records.size())
+    return false;
+  for (size_t index = 0; index < a.records.size(); index++) {
+    const device_groups_capture_record &record_a = a.records[index];
+    const device_groups_capture_record &record_b = b.records[index];
+    if (record_a.time_ms != record_b.time_ms || record_a.source != record_b.source ||
+        record_a.payload != record_b.payload)
+      return false;
+  }
+  return true;
+}
+
+static bool write_file(const char *path, const std::vector<uint8_t> &data) {
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return false;
+  bool written = (fwrite(data.data(), 1, data.size(), file) == data.size());
+  return !fclose(file) && written;
+}
+
+static void put32(std::vector<uint8_t> &data, uint32_t value) {
+  for (uint32_t byte = 0; byte < 4; byte++)
+    data.push_back(value >> (byte * 8));
+}
+
+// The records as tcpdump -w would have written them, each in an Ethernet frame.
+static std::vector<uint8_t> pcap_file(const device_groups_Capture &capture) {
+  std::vector<uint8_t> data;
+  put32(data, 0xa1b2c3d4);
+  put32(data, 4 << 16 | 2);  // Version 2.4
+  put32(data, 0);
+  put32(data, 0);
+  put32(data, 65535);
+  put32(data, 1);  // Ethernet
+  for (const device_groups_capture_record &record : capture.records) {
+    uint32_t udp_length = 8 + record.payload.size();
+    uint32_t frame_length = 14 + 20 + udp_length;
+    put32(data, record.time_ms / 1000);
+    put32(data, record.time_ms % 1000 * 1000);
+    put32(data, frame_length);
+    put32(data, frame_length);
+    const uint8_t ethernet[14] = {1, 0, 0x5e, 0x7f, 0xfa, 0xfa, 2, 0, 0, 0, 0, 1, 0x08, 0x00};
+    data.insert(data.end(), ethernet, ethernet + sizeof(ethernet));
+    const uint8_t ip[20] = {0x45, 0, (uint8_t) ((20 + udp_length) >> 8), (uint8_t) (20 + udp_length), 0, 0, 0x40, 0,
+                            1, 17, 0, 0, record.source[0], record.source[1], record.source[2], record.source[3],
+                            239, 255, 250, 250};
+    data.insert(data.end(), ip, ip + sizeof(ip));
+    const uint8_t udp[8] = {DEVICE_GROUPS_PORT >> 8, DEVICE_GROUPS_PORT & 0xff, DEVICE_GROUPS_PORT >> 8,
+                            DEVICE_GROUPS_PORT & 0xff, (uint8_t) (udp_length >> 8), (uint8_t) udp_length, 0, 0};
+    data.insert(data.end(), udp, udp + sizeof(udp));
+    data.insert(data.end(), record.payload.begin(), record.payload.end());
+  }
+  return data;
+}
+
+// The records as a device with USE_DEVICE_GROUPS_CAPTURE logs them, mixed in with other log lines.
+static std::vector<uint8_t> log_file(const device_groups_Capture &capture) {
+  std::string text = "[12:00:00][I][app:100]: ESPHome version 2024.6.0\n";
+  for (const device_groups_capture_record &record : capture.records) {
+    std::vector<uint8_t> encoded;
+    device_groups_Capture::encode(record.time_ms, record.source, record.payload.data(), record.payload.size(),
+                                  encoded);
+    for (size_t offset = 0; offset < encoded.size(); offset += DGR_CAPTURE_LOG_CHUNK) {
+      text += "[12:00:01][I][dgr:2400]: " DGR_CAPTURE_LOG_PREFIX;
+      text += (offset ? '+' : ' ');
+      for (size_t index = offset; index < encoded.size() && index < offset + DGR_CAPTURE_LOG_CHUNK; index++) {
+        char hex[3];
+        snprintf(hex, sizeof(hex), "%02x", encoded[index]);
+        text += hex;
+      }
+      text += '\n';
+    }
+  }
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+// Traffic recorded at one device loads back the same from a capture file, a pcap file and a log, and
+// replayed into a new device leaves it in the state the traffic left the first one in.
+static void test_capture() {
+  start("capture", 0);
+  device_groups_Capture recorded;
+  {
+    sim_devices devices;
+    sim_add_devices(devices, 2);
+    devices[1]->set_capture(&recorded);
+    sim_run(devices, SIM_SETTLE_TIME);
+    for (uint32_t update = 0; update < 3; update++) {
+      devices[0]->toggle();
+      sim_run(devices, 1000);
+    }
+    SIM_CHECK(devices[1]->relay.state);
+    devices[1]->set_capture(nullptr);
+  }
+  SIM_CHECK(recorded.records.size() > 3);
+
+  char path[] = "/tmp/dgr_sim_testXXXXXX";
+  int fd = mkstemp(path);
+  SIM_CHECK(fd >= 0);
+  if (fd < 0)
+    return;
+  close(fd);
+  device_groups_Capture loaded;
+  SIM_CHECK(recorded.save(path));
+  SIM_CHECK(loaded.load(path));
+  SIM_CHECK(same_records(recorded, loaded));
+  SIM_CHECK(write_file(path, pcap_file(recorded)));
+  SIM_CHECK(loaded.load(path));
+  SIM_CHECK(same_records(recorded, loaded));
+  SIM_CHECK(write_file(path, log_file(recorded)));
+  SIM_CHECK(loaded.load(path));
+  SIM_CHECK(same_records(recorded, loaded));
+  unlink(path);
+
+  start("replay", 0);
+  sim_devices devices;
+  sim_add_devices(devices, 1);
+  sim_step(devices);
+  devices[0]->replay_capture(loaded, 1);
+  sim_run(devices, recorded.records.back().time_ms - recorded.records.front().time_ms + 1000);
+  SIM_CHECK(devices[0]->relay.state);
+  SIM_CHECK(devices[0]->member_count() == 1);
+}
+
+int main() {
+  sim_log_from_environment();
+  test_discovery();
+  test_retransmission();
+  test_member_timeout();
+  test_reordering();
+  test_multiple_relays();
+  test_group_names();
+  test_priority();
+  test_loop_budget();
+  test_ack_delay();
+  test_in_flight();
+  test_split(0);
+  test_split(20);
+  test_capture();
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All tests passed\n");
+  return 0;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+// The simulated fabric brings its own IPAddress.
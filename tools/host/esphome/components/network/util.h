@@ -0,0 +1,10 @@
+#pragma once
+
+namespace esphome {
+namespace network {
+
+// Always true on the host: a simulated device is taken off the network by no longer calling its loop().
+bool is_connected();
+
+}  // namespace network
+}  // namespace esphome
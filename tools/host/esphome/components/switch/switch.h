@@ -0,0 +1,38 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include "esphome/core/component.h"
+
+namespace esphome {
+namespace switch_ {
+
+// A switch whose state is whatever it was last told. Like ESPHome, a state is only published to the
+// callbacks when it differs from the last one.
+class Switch : public EntityBase {
+ public:
+  bool state{false};
+
+  void turn_on() { this->write_state(true); }
+  void turn_off() { this->write_state(false); }
+  void publish_state(bool state) {
+    if (this->published_ && state == this->state)
+      return;
+    this->published_ = true;
+    this->state = state;
+    for (auto &callback : this->state_callbacks_)
+      callback(state);
+  }
+  void add_on_state_callback(std::function<void(bool)> &&callback) {
+    this->state_callbacks_.push_back(std::move(callback));
+  }
+
+ protected:
+  virtual void write_state(bool state) { this->publish_state(state); }
+
+  bool published_{false};
+  std::vector<std::function<void(bool)>> state_callbacks_;
+};
+
+}  // namespace switch_
+}  // namespace esphome
@@ -0,0 +1,35 @@
+#pragma once
+
+// Host build shims: just enough of ESPHome for the device_groups component to run in a simulation
+// on a Linux box. Only what the component uses is here, and it behaves like ESPHome where the
+// component can tell the difference.
+
+#include <stdint.h>
+#include <string>
+
+namespace esphome {
+
+namespace setup_priority {
+const float AFTER_WIFI = 250.0f;
+}  // namespace setup_priority
+
+class Component {
+ public:
+  virtual ~Component() = default;
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual float get_setup_priority() const { return 0.0f; }
+};
+
+class EntityBase {
+ public:
+  void set_name(const std::string &name) { this->name_ = name; }
+  const std::string &get_name() const { return this->name_; }
+  const std::string &get_object_id() const { return this->name_; }
+
+ protected:
+  std::string name_;
+};
+
+}  // namespace esphome
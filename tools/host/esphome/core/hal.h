@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace esphome {
+
+// Simulations run on the fabric's virtual clock; these only serve the odd call outside it.
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+
+}  // namespace esphome
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "esphome/core/hal.h"
+
+namespace esphome {
+
+uint32_t random_uint32();
+
+}  // namespace esphome
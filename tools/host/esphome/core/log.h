@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#define ESPHOME_LOG_LEVEL_NONE 0
+#define ESPHOME_LOG_LEVEL_ERROR 1
+#define ESPHOME_LOG_LEVEL_WARN 2
+#define ESPHOME_LOG_LEVEL_INFO 3
+#define ESPHOME_LOG_LEVEL_CONFIG 4
+#define ESPHOME_LOG_LEVEL_DEBUG 5
+#define ESPHOME_LOG_LEVEL_VERBOSE 6
+#define ESPHOME_LOG_LEVEL_VERY_VERBOSE 7
+
+namespace esphome {
+
+// Messages above this level are dropped, so a long simulation isn't slowed down by its own log.
+extern int host_log_level;
+
+void host_log(int level, const char *letter, const char *tag, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+}  // namespace esphome
+
+#define ESP_LOGE(tag, ...) esphome::host_log(ESPHOME_LOG_LEVEL_ERROR, "E", tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) esphome::host_log(ESPHOME_LOG_LEVEL_WARN, "W", tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) esphome::host_log(ESPHOME_LOG_LEVEL_INFO, "I", tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) esphome::host_log(ESPHOME_LOG_LEVEL_CONFIG, "C", tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) esphome::host_log(ESPHOME_LOG_LEVEL_DEBUG, "D", tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) esphome::host_log(ESPHOME_LOG_LEVEL_VERBOSE, "V", tag, __VA_ARGS__)
+#define ESP_LOGVV(tag, ...) esphome::host_log(ESPHOME_LOG_LEVEL_VERY_VERBOSE, "VV", tag, __VA_ARGS__)
@@ -0,0 +1,34 @@
+// Host build shims, see esphome/core/component.h.
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esphome/components/network/util.h"
+#include "device_groups_SimUdp.h"
+#include <stdarg.h>
+
+namespace esphome {
+
+int host_log_level = ESPHOME_LOG_LEVEL_WARN;
+
+void host_log(int level, const char *letter, const char *tag, const char *format, ...) {
+  if (level > host_log_level)
+    return;
+  va_list args;
+  va_start(args, format);
+  printf("%7u [%s][%s]: ", device_groups_SimUDP::now(), letter, tag);
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+}
+
+uint32_t millis() { return device_groups_SimUDP::now(); }
+uint32_t micros() { return device_groups_SimUDP::micros(); }
+void delay(uint32_t ms) {}
+uint32_t random_uint32() { return device_groups_SimUDP::random(); }
+
+namespace network {
+bool is_connected() { return true; }
+}  // namespace network
+
+}  // namespace esphome